@@ -0,0 +1,490 @@
+/**
+    Benchmarks of each stage of the Hand Gesture Classifier pipeline: reading the images, preprocessing them at several resolutions,
+    converting them to the model format, predicting them and creating the whole dataset, with several numbers of threads.
+    It runs over the images in the images folder, so it has to be launched from the folder of the project.
+
+    Usage: HandNumbersClassifierBenchmark [--images N] [--repetitions N] [--threads 1,2,4] [--output file.csv] [--baseline file.csv]
+    The results are written as CSV (one line per stage, configuration and number of threads). When a baseline file from a previous run
+    is given, the median latency of every stage is compared against it and the regressions are reported.
+*/
+
+#include <iostream>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "BinaryMorphology.h"
+#include "BitPacked.h"
+#include "Dataset.h"
+#include "HsvCalibration.h"
+#include "HsvThreshold.h"
+#include "ImageLoader.h"
+#include "Model.h"
+#include "ModelBundle.h"
+#include "Preprocessing.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+using namespace cv;
+
+// Relative increase of the median latency over the baseline that is reported as a regression
+const double REGRESSION_THRESHOLD = 0.10;
+
+/**
+    Structure with the measures of one stage: the latency of every run and the number of items (frames, images) each run processes.
+*/
+struct StageResult {
+    string stage;
+    string config;
+    int threads;
+    int itemsPerRun;
+    vector<double> latenciesMs;
+
+    double percentile(double p) const {
+        vector<double> sorted = latenciesMs;
+        sort(sorted.begin(), sorted.end());
+        int index = max(0, min((int)sorted.size() - 1, (int)ceil(p * sorted.size()) - 1));
+        return sorted[index];
+    }
+    double minMs() const { return *min_element(latenciesMs.begin(), latenciesMs.end()); }
+    double medianMs() const { return percentile(0.5); }
+    double p99Ms() const { return percentile(0.99); }
+    double throughput() const {
+        double total = 0;
+        for (size_t i = 0; i < latenciesMs.size(); i++)
+            total += latenciesMs[i];
+        return total > 0 ? itemsPerRun * latenciesMs.size() * 1000.0 / total : 0;
+    }
+    string key() const {
+        stringstream ss;
+        ss << stage << "," << config << "," << threads;
+        return ss.str();
+    }
+};
+
+/**
+    Function that measures a stage running it several times.
+    Params:
+        stage - Name of the stage
+        config - Description of the configuration of the stage (resolution, ...)
+        threads - Number of threads used by the stage
+        runs - Number of times it is measured (after one warm-up run)
+        itemsPerRun - Number of items processed by each run, for the throughput
+        run - The function to measure; it gets the index of the run
+    Returns: the measures of the stage.
+*/
+StageResult measure(const string& stage, const string& config, int threads, int runs, int itemsPerRun, const function<void(int)>& run){
+    StageResult result;
+    result.stage = stage;
+    result.config = config;
+    result.threads = threads;
+    result.itemsPerRun = itemsPerRun;
+
+    run(0);
+    for (int r = 0; r < runs; r++) {
+        int64 startTicks = getTickCount();
+        run(r);
+        result.latenciesMs.push_back((getTickCount() - startTicks) * 1000.0 / getTickFrequency());
+    }
+
+    cout << " " << stage << " [" << config << ", " << threads << " threads]: min " << result.minMs() << " ms, median " << result.medianMs()
+         << " ms, p99 " << result.p99Ms() << " ms, " << result.throughput() << " items/s" << endl;
+    return result;
+}
+
+/**
+    Function that checks the fused HSV threshold against cv::cvtColor(CV_BGR2HSV) + cv::inRange.
+    Returns: the number of different pixels over all the images.
+*/
+size_t checkThreshold(const vector<Mat>& images, int* hsvConfig){
+    size_t mismatches = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        Mat hsv, expected, fused;
+        cv::cvtColor(images[i], hsv, CV_BGR2HSV);
+        cv::inRange(hsv, cv::Scalar(hsvConfig[0], hsvConfig[2], hsvConfig[4]), cv::Scalar(hsvConfig[1], hsvConfig[3], hsvConfig[5]), expected);
+        thresholdHsv(images[i], fused, hsvConfig);
+        Mat diff = expected != fused;
+        mismatches += countNonZero(diff);
+    }
+    return mismatches;
+}
+
+/**
+    Function that checks the binary morphology against cv::medianBlur + cv::dilate over the thresholded images,
+    with the sizes of the full resolution (median of 5, ellipse of 11x11).
+    Returns: the number of pixels that are different.
+*/
+size_t checkMorphology(const vector<Mat>& images, int* hsvConfig){
+    Mat element = getStructuringElement(MORPH_ELLIPSE, Size(11, 11), Point(5, 5));
+    BinaryMorphology morphology;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        Mat mask, filtered, expected, packed;
+        thresholdHsv(images[i], mask, hsvConfig);
+        cv::medianBlur(mask, filtered, 5);
+        cv::dilate(filtered, expected, element, Point(5, 5));
+        if (!morphology.medianDilate(mask, 5, element, Point(5, 5), packed))
+            return expected.total();
+        Mat diff = expected != packed;
+        mismatches += countNonZero(diff);
+    }
+    return mismatches;
+}
+
+/**
+    Function that writes the results in CSV format.
+*/
+void writeResults(const string& fileName, const vector<StageResult>& results){
+    ofstream out(fileName.c_str());
+    if (!out.is_open()) {
+        cout << "Error writing the results file: " << fileName << endl;
+        return;
+    }
+    out << "stage,config,threads,runs,min_ms,median_ms,p99_ms,items_per_second\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const StageResult& r = results[i];
+        out << r.key() << "," << r.latenciesMs.size() << "," << r.minMs() << "," << r.medianMs() << "," << r.p99Ms() << "," << r.throughput() << "\n";
+    }
+    cout << "Results written in " << fileName << endl;
+}
+
+/**
+    Function that compares the results with the ones of a previous run and reports the stages that got slower.
+    Returns: the number of regressions.
+*/
+int compareWithBaseline(const string& fileName, const vector<StageResult>& results){
+    ifstream in(fileName.c_str());
+    if (!in.is_open()) {
+        cout << "Error reading the baseline file: " << fileName << endl;
+        return 0;
+    }
+
+    // Median latency of every stage of the baseline
+    map<string, double> baseline;
+    string line;
+    getline(in, line);
+    while (getline(in, line)) {
+        vector<string> fields;
+        stringstream ss(line);
+        string field;
+        while (getline(ss, field, ','))
+            fields.push_back(field);
+        if (fields.size() >= 6)
+            baseline[fields[0] + "," + fields[1] + "," + fields[2]] = atof(fields[5].c_str());
+    }
+
+    cout << endl << "Comparison with the baseline " << fileName << " (median latency)" << endl;
+    int regressions = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        map<string, double>::const_iterator it = baseline.find(results[i].key());
+        if (it == baseline.end() || it->second <= 0)
+            continue;
+        double change = results[i].medianMs() / it->second - 1;
+        bool regression = change > REGRESSION_THRESHOLD;
+        if (regression)
+            regressions++;
+        cout << " " << results[i].key() << ": " << it->second << " ms -> " << results[i].medianMs() << " ms ("
+             << (change >= 0 ? "+" : "") << change * 100 << "%)" << (regression ? " REGRESSION" : "") << endl;
+    }
+    cout << regressions << " regressions" << endl;
+    return regressions;
+}
+
+
+/**
+    Main function of the benchmarks.
+*/
+int main( int argc, char** argv )
+{
+    // Read the options
+    int numImages = 50;
+    int repetitions = 20;
+    vector<int> threadCounts;
+    string outputFile = "benchmark_results.csv";
+    string baselineFile;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        if (option == "--images")
+            numImages = atoi(argv[i + 1]);
+        else if (option == "--repetitions")
+            repetitions = atoi(argv[i + 1]);
+        else if (option == "--output")
+            outputFile = argv[i + 1];
+        else if (option == "--baseline")
+            baselineFile = argv[i + 1];
+        else if (option == "--threads") {
+            stringstream ss(argv[i + 1]);
+            string count;
+            while (getline(ss, count, ','))
+                threadCounts.push_back(atoi(count.c_str()));
+        } else {
+            cout << "Unknown option: " << option << endl;
+            return 1;
+        }
+    }
+    int maxThreads = getNumberOfCPUs();
+    if (threadCounts.empty()) {
+        threadCounts.push_back(1);
+        if (maxThreads > 1)
+            threadCounts.push_back(maxThreads);
+    }
+
+    // Load a sample of the dataset spread over all the classes
+    vector<DatasetEntry> entries;
+    if (!listDataset(entries) || entries.empty()) {
+        cout << "No images found in the images folder" << endl;
+        return 1;
+    }
+    vector<DatasetEntry> sample;
+    size_t stepImages = max((size_t)1, entries.size() / max(1, numImages));
+    for (size_t i = 0; i < entries.size() && (int)sample.size() < numImages; i += stepImages)
+        sample.push_back(entries[i]);
+    vector<Mat> images;
+    for (size_t i = 0; i < sample.size(); i++)
+        images.push_back(imread(sample[i].path));
+    cout << "Loaded " << images.size() << " images of " << images[0].cols << "x" << images[0].rows << endl;
+
+    // Static values for perfect threshold of training test images (the ones used by createData)
+    int hsvConfig [6]= {10, 160, 0, 200, 10, 130};
+    size_t mismatches = checkThreshold(images, hsvConfig);
+    cout << "Fused HSV threshold: " << mismatches << " different pixels" << (mismatches == 0 ? " (bit-exact)" : " (NOT bit-exact)") << endl;
+    mismatches = checkMorphology(images, hsvConfig);
+    cout << "Binary morphology: " << mismatches << " different pixels" << (mismatches == 0 ? " (bit-exact)" : " (NOT bit-exact)") << endl;
+
+    // Thresholded masks of the images at full resolution, for the morphology stages
+    vector<Mat> masks(images.size());
+    for (size_t i = 0; i < images.size(); i++)
+        thresholdHsv(images[i], masks[i], hsvConfig);
+    Mat fullElement = getStructuringElement(MORPH_ELLIPSE, Size(11, 11), Point(5, 5));
+    stringstream fullSize;
+    fullSize << images[0].cols << "x" << images[0].rows;
+
+    // Files of the images in memory, for the decoding stages, and what each decoding path reads and produces per image
+    vector<vector<uchar> > files(sample.size());
+    size_t fileBytes = 0, reducedBytes = 0;
+    int decodeFactor = 1;
+    Mat reduced;
+    for (size_t i = 0; i < sample.size(); i++) {
+        readFileBytes(sample[i].path, files[i]);
+        fileBytes += files[i].size();
+        decodeImage(files[i], PreprocessConfig().workWidth, reduced, &decodeFactor);
+        reducedBytes += reduced.total() * reduced.elemSize();
+    }
+    size_t fullBytes = 0;
+    for (size_t i = 0; i < images.size(); i++)
+        fullBytes += images[i].total() * images[i].elemSize();
+    cout << "Per image: " << fileBytes / 1024.0 / sample.size() << " KB read, " << fullBytes / 1024.0 / images.size() << " KB decoded by imread, "
+         << reducedBytes / 1024.0 / sample.size() << " KB decoded reduced by " << decodeFactor << endl;
+
+    // Processed pixels that change when the images are decoded reduced instead of resized by processImage
+    size_t changedPixels = 0, totalPixels = 0;
+    for (size_t i = 0; i < sample.size(); i++) {
+        decodeImage(files[i], PreprocessConfig().workWidth, reduced);
+        Mat diff = processImage(images[i], hsvConfig) != processImage(reduced, hsvConfig);
+        changedPixels += countNonZero(diff);
+        totalPixels += diff.total();
+    }
+    cout << "Reduced decoding: " << (totalPixels > 0 ? changedPixels * 100.0 / totalPixels : 0) << "% of the processed pixels are different" << endl;
+
+    // Preprocessing configurations to compare
+    vector<PreprocessConfig> configs;
+    configs.push_back(PreprocessConfig::legacy());
+    configs.push_back(PreprocessConfig());
+    PreprocessConfig small;
+    small.workWidth = 320;
+    small.featureSize = Size(80, 45);
+    configs.push_back(small);
+    configs.push_back(PreprocessConfig::cropped());
+
+    // The model, if there is one, for the prediction stages
+    HandModel model;
+    bool hasModel = loadModel("HandNumbersClassifier_01.dat", model);
+    if (!hasModel)
+        cout << "No model found (HandNumbersClassifier_01.dat), the prediction stages are skipped" << endl;
+
+    vector<StageResult> results;
+    int numFrames = (int)images.size();
+    for (size_t t = 0; t < threadCounts.size(); t++) {
+        int threads = threadCounts[t];
+        setNumThreads(threads);
+        cout << endl << "Threads: " << threads << endl;
+
+        // Reading the images
+        results.push_back(measure("imread", "full", threads, max(1, repetitions / 10), numFrames, [&](int) {
+            for (size_t i = 0; i < sample.size(); i++)
+                imread(sample[i].path);
+        }));
+
+        // Decoding the files already in memory: full resolution and reduced to the working resolution of the default preprocessing
+        results.push_back(measure("imdecode", "full", threads, max(1, repetitions / 10), numFrames, [&](int) {
+            Mat img;
+            for (size_t i = 0; i < files.size(); i++)
+                decodeImage(files[i], 0, img);
+        }));
+        results.push_back(measure("imdecode", "reduced", threads, max(1, repetitions / 10), numFrames, [&](int) {
+            Mat img;
+            for (size_t i = 0; i < files.size(); i++)
+                decodeImage(files[i], PreprocessConfig().workWidth, img);
+        }));
+
+        // Thresholding: OpenCV path and fused table
+        results.push_back(measure("cvtColor+inRange", "full", threads, repetitions, 1, [&](int r) {
+            Mat hsv, mask;
+            cv::cvtColor(images[r % numFrames], hsv, CV_BGR2HSV);
+            cv::inRange(hsv, cv::Scalar(hsvConfig[0], hsvConfig[2], hsvConfig[4]), cv::Scalar(hsvConfig[1], hsvConfig[3], hsvConfig[5]), mask);
+        }));
+        results.push_back(measure("thresholdHsv", "full", threads, repetitions, 1, [&](int r) {
+            Mat mask;
+            thresholdHsv(images[r % numFrames], mask, hsvConfig);
+        }));
+
+        // A slider move of the camera configuration: thresholding a frame with a new HSV configuration, through the table of thresholdHsv
+        // (built for every new configuration: the moves cycle over more configurations than the tables kept) and through the HSV conversion
+        // cached by the calibration
+        int moves = 0;
+        results.push_back(measure("slider move: thresholdHsv", "full", threads, max(1, repetitions / 10), 1, [&](int) {
+            int moved [6]= {hsvConfig[0], hsvConfig[1] - 1 - (int)(moves++ % (2 * MAX_HSV_TABLES)), hsvConfig[2], hsvConfig[3], hsvConfig[4], hsvConfig[5]};
+            Mat mask;
+            thresholdHsv(images[0], mask, moved);
+        }));
+        HsvCalibration calibration;
+        calibration.setFrame(images[0]);
+        results.push_back(measure("slider move: calibration preview", "full", threads, repetitions, 1, [&](int r) {
+            int moved [6]= {hsvConfig[0], hsvConfig[1] - r % 2, hsvConfig[2], hsvConfig[3], hsvConfig[4], hsvConfig[5]};
+            Mat mask;
+            calibration.preview(moved, mask);
+        }));
+
+        // Median blur and dilation of the full resolution masks: OpenCV functions and binary morphology over packed rows
+        results.push_back(measure("medianBlur+dilate", fullSize.str(), threads, repetitions, 1, [&](int r) {
+            Mat filtered, dilated;
+            cv::medianBlur(masks[r % numFrames], filtered, 5);
+            cv::dilate(filtered, dilated, fullElement, Point(5, 5));
+        }));
+        BinaryMorphology morphology;
+        results.push_back(measure("binary medianDilate", fullSize.str(), threads, repetitions, 1, [&](int r) {
+            Mat dilated;
+            morphology.medianDilate(masks[r % numFrames], 5, fullElement, Point(5, 5), dilated);
+        }));
+
+        // Preprocessing at each resolution
+        for (size_t c = 0; c < configs.size(); c++) {
+            stringstream name;
+            name << "work " << (configs[c].isLegacy() ? images[0].cols : configs[c].workWidth) << " feature " << configs[c].featureSize.width << "x" << configs[c].featureSize.height
+                 << (configs[c].cropsHand() ? " crop" : "");
+            results.push_back(measure("processImage", name.str(), threads, repetitions, 1, [&](int r) {
+                processImage(images[r % numFrames], hsvConfig, configs[c]);
+            }));
+        }
+
+        // Conversion to the model format and prediction, with the preprocessing of the model
+        if (hasModel) {
+            stringstream name;
+            name << model.preprocessing.featureSize.width << "x" << model.preprocessing.featureSize.height;
+            vector<Mat> processed;
+            for (int i = 0; i < numFrames; i++)
+                processed.push_back(processImage(images[i], hsvConfig, model.preprocessing));
+
+            results.push_back(measure("convertTo+reshape", name.str(), threads, repetitions, 1, [&](int r) {
+                Mat floatImg;
+                processed[r % numFrames].convertTo(floatImg, CV_32F);
+                floatImg.reshape(1,1);
+            }));
+            // Loading the model: parsing the SVM file or mapping the bundle
+            results.push_back(measure("loadModel", "HandNumbersClassifier_01.dat", threads, max(1, repetitions / 10), 1, [&](int) {
+                HandModel loaded;
+                loadModel("HandNumbersClassifier_01.dat", loaded);
+            }));
+            HandModel bundled;
+            if (loadModelBundle("HandNumbersClassifier_01.bin", bundled)) {
+                results.push_back(measure("loadModelBundle", "HandNumbersClassifier_01.bin", threads, repetitions, 1, [&](int) {
+                    HandModel loaded;
+                    loadModelBundle("HandNumbersClassifier_01.bin", loaded);
+                }));
+            }
+            results.push_back(measure("svm->predict", name.str(), threads, repetitions, 1, [&](int r) {
+                Mat floatImg, responses;
+                processed[r % numFrames].convertTo(floatImg, CV_32F);
+                predictFeatureRows(model, floatImg.reshape(1,1), responses);
+            }));
+            if (!model.projection.empty() && modelFeatures(model)->isRaw()) {
+                vector<float> projected(model.projection.getComponentCount());
+                results.push_back(measure("pca projection", name.str(), threads, repetitions, 1, [&](int r) {
+                    model.projection.project(processed[r % numFrames].ptr<uchar>(), &projected[0]);
+                }));
+            }
+            if (!model.scorer.empty() && modelFeatures(model)->isRaw()) {
+                results.push_back(measure("linear scorer", name.str(), threads, repetitions, 1, [&](int r) {
+                    model.scorer.predict(processed[r % numFrames].ptr<uchar>());
+                }));
+            }
+            if (!model.packedScorer.empty()) {
+                vector<uint64_t> packed(packedWords(model.preprocessing.featureSize.area()));
+                results.push_back(measure("pack+bitplane scorer", name.str(), threads, repetitions, 1, [&](int r) {
+                    packMask(processed[r % numFrames].ptr<uchar>(), (int)processed[r % numFrames].total(), &packed[0]);
+                    model.packedScorer.predict(&packed[0]);
+                }));
+            }
+        }
+
+        // Feature extractors over the processed images of the default preprocessing
+        {
+            vector<Mat> processed;
+            for (int i = 0; i < numFrames; i++)
+                processed.push_back(processImage(images[i], hsvConfig, configs[1]));
+            vector<string> names = featureExtractorNames();
+            for (size_t n = 0; n < names.size(); n++) {
+                const FeatureExtractor* extractor = getFeatureExtractor(names[n]);
+                vector<float> features(extractor->size(processed[0].size()));
+                results.push_back(measure("features", names[n], threads, repetitions, 1, [&](int r) {
+                    extractor->compute(processed[r % numFrames], &features[0]);
+                }));
+            }
+        }
+
+        // The loop of createData: reading and preprocessing the images in the pool
+        for (size_t c = 0; c < configs.size(); c++) {
+            stringstream name;
+            name << "feature " << configs[c].featureSize.width << "x" << configs[c].featureSize.height << (configs[c].cropsHand() ? " crop" : "");
+            WorkStealingPool pool(threads);
+            results.push_back(measure("createData loop", name.str(), threads, max(1, repetitions / 10), (int)sample.size(), [&](int) {
+                vector<Mat> processed(sample.size());
+                pool.parallelFor(0, (int)sample.size(), [&](int i) {
+                    processed[i] = processImage(imread(sample[i].path), hsvConfig, configs[c]);
+                });
+            }));
+            results.push_back(measure("createData loop prefetched", name.str(), threads, max(1, repetitions / 10), (int)sample.size(), [&](int) {
+                vector<Mat> processed(sample.size());
+                vector<string> paths(sample.size());
+                for (size_t i = 0; i < sample.size(); i++)
+                    paths[i] = sample[i].path;
+                ImagePrefetcher prefetcher(paths, 4 * pool.size());
+                pool.parallelFor(0, pool.size(), [&](int) {
+                    vector<uchar> bytes;
+                    Mat img;
+                    PreprocessWorkspace workspace;
+                    int i;
+                    while (prefetcher.next(i, bytes)) {
+                        decodeImage(bytes, configs[c].workWidth, img);
+                        processed[i] = processImage(img, hsvConfig, configs[c], workspace).clone();
+                    }
+                });
+            }));
+        }
+    }
+    setNumThreads(-1);
+
+    cout << endl;
+    writeResults(outputFile, results);
+    if (!baselineFile.empty() && compareWithBaseline(baselineFile, results) > 0)
+        return 2;
+
+    return 0;
+}
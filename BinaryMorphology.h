@@ -0,0 +1,295 @@
+/**
+    Morphology of the binary masks (0/255) given by the HSV threshold, over bit-packed rows (64 pixels per word) instead of bytes:
+    the median blur is a majority vote, counted for 64 pixels at a time with bit-sliced adders (each bit of the count is a word of its own),
+    and the dilation with an elliptical element is the OR of the rows of the mask dilated horizontally by the half-width of each row of the element.
+    The results are bit-identical to cv::medianBlur (replicated border) and cv::dilate (pixels out of the image ignored) over the same masks.
+    The rows are processed in parallel bands.
+*/
+
+#ifndef BINARY_MORPHOLOGY_H
+#define BINARY_MORPHOLOGY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "BitPacked.h"
+
+class BinaryMorphology {
+public:
+
+    // Rows of each band processed in parallel
+    static const int BAND_ROWS = 32;
+    // Maximum size of the median, its count (up to 15x15) fits in 8 bit planes
+    static const int MAX_MEDIAN_SIZE = 15;
+
+    BinaryMorphology() : width(0), height(0), rowWords(0) {}
+
+    /**
+        Returns: true if the element is supported: every row is empty or a span of columns centered on the anchor (as the elliptical,
+        cross and rectangular elements with a centered anchor are).
+    */
+    static bool supports(const cv::Mat& element, cv::Point anchor) {
+        std::vector<int> halfWidths;
+        return rowHalfWidths(element, anchor, halfWidths);
+    }
+
+    /**
+        Applies the median blur followed by the dilation to a binary mask, as cv::medianBlur(mask, filtered, blurSize) followed by
+        cv::dilate(filtered, result, element, anchor) would do.
+        Params:
+            mask - The binary mask (8 bits, 0 or 255)
+            blurSize - The size of the median (odd, up to MAX_MEDIAN_SIZE), or 1 for no median
+            element - The structuring element of the dilation, supported by supports()
+            anchor - The anchor of the element
+            result - The blurred and dilated mask (0 or 255)
+        Returns: false if the sizes are not supported (the caller should use the OpenCV functions).
+    */
+    bool medianDilate(const cv::Mat& mask, int blurSize, const cv::Mat& element, cv::Point anchor, cv::Mat& result) {
+        if (mask.type() != CV_8U || blurSize < 1 || blurSize % 2 == 0 || blurSize > MAX_MEDIAN_SIZE || !rowHalfWidths(element, anchor, halfWidths))
+            return false;
+        resize(mask.size());
+
+        cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; y++)
+                packMask(mask.ptr<uchar>(y), width, &source[(size_t)y * rowWords]);
+        }, bands());
+
+        const std::vector<uint64_t>* filtered = &source;
+        if (blurSize > 1) {
+            cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range) {
+                std::vector<uint64_t> scratch;
+                for (int y = range.start; y < range.end; y++)
+                    medianRow(y, blurSize, scratch);
+            }, bands());
+            filtered = &median;
+        }
+
+        dilateRows(*filtered, anchor);
+
+        result.create(height, width, CV_8U);
+        cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; y++)
+                unpackMask(&dilated[(size_t)y * rowWords], width, result.ptr<uchar>(y));
+        }, bands());
+        return true;
+    }
+
+private:
+
+    // Half-width of each row of the element around the anchor, -1 for empty rows
+    static bool rowHalfWidths(const cv::Mat& element, cv::Point anchor, std::vector<int>& halfWidths) {
+        if (element.empty() || element.type() != CV_8U || anchor.x < 0 || anchor.x >= element.cols || anchor.y < 0 || anchor.y >= element.rows)
+            return false;
+        halfWidths.assign(element.rows, -1);
+        bool any = false;
+        for (int i = 0; i < element.rows; i++) {
+            const uchar* row = element.ptr<uchar>(i);
+            int first = -1, last = -1;
+            for (int j = 0; j < element.cols; j++) {
+                if (row[j] == 0)
+                    continue;
+                if (first < 0)
+                    first = j;
+                else if (j != last + 1)
+                    return false;
+                last = j;
+            }
+            if (first < 0)
+                continue;
+            if (anchor.x - first != last - anchor.x || anchor.x - first > 63)
+                return false;
+            halfWidths[i] = anchor.x - first;
+            any = true;
+        }
+        return any;
+    }
+
+    void resize(cv::Size size) {
+        width = size.width;
+        height = size.height;
+        rowWords = packedWords(width);
+        source.resize((size_t)height * rowWords);
+        median.resize((size_t)height * rowWords);
+        dilated.resize((size_t)height * rowWords);
+    }
+
+    double bands() const {
+        return std::max(1, (height + BAND_ROWS - 1) / BAND_ROWS);
+    }
+
+    // Bits of a packed row with the pixels shifted by s: bit x of the result is pixel x + s (0 out of the row)
+    static uint64_t shiftedWord(const uint64_t* row, int words, int w, int s) {
+        if (s == 0)
+            return row[w];
+        if (s > 0) {
+            int q = s >> 6, r = s & 63;
+            uint64_t lo = w + q < words ? row[w + q] : 0;
+            uint64_t hi = w + q + 1 < words ? row[w + q + 1] : 0;
+            return r == 0 ? lo : (lo >> r) | (hi << (64 - r));
+        }
+        s = -s;
+        int q = s >> 6, r = s & 63;
+        uint64_t hi = w - q >= 0 && w - q < words ? row[w - q] : 0;
+        uint64_t lo = w - q - 1 >= 0 && w - q - 1 < words ? row[w - q - 1] : 0;
+        return r == 0 ? hi : (hi << r) | (lo >> (64 - r));
+    }
+
+    // Mask of the pixels of the last word of a row
+    uint64_t lastWordMask() const {
+        return width % 64 == 0 ? ~(uint64_t)0 : ((uint64_t)1 << (width % 64)) - 1;
+    }
+
+    /**
+        Median of the row y: the pixel is set if at least (k * k + 1) / 2 pixels of its k x k window are set, with the border replicated.
+        The vertical counts of each column are added first (bit planes of the count, with the columns padded by the replicated border),
+        then the k shifted counts of each column, and the sum is compared with the majority.
+    */
+    void medianRow(int y, int k, std::vector<uint64_t>& scratch) {
+        int r = k / 2;
+        int countBits = bitsFor(k), sumBits = bitsFor(k * k);
+        int paddedWidth = width + 2 * r;
+        int paddedWords = packedWords(paddedWidth);
+
+        // Vertical counts, in countBits planes of rowWords words
+        scratch.assign((size_t)countBits * rowWords + (size_t)countBits * paddedWords, 0);
+        uint64_t* counts = &scratch[0];
+        for (int dy = -r; dy <= r; dy++) {
+            const uint64_t* row = &source[(size_t)std::min(height - 1, std::max(0, y + dy)) * rowWords];
+            for (int w = 0; w < rowWords; w++) {
+                uint64_t carry = row[w];
+                for (int b = 0; b < countBits && carry != 0; b++) {
+                    uint64_t c = counts[(size_t)b * rowWords + w];
+                    counts[(size_t)b * rowWords + w] = c ^ carry;
+                    carry &= c;
+                }
+            }
+        }
+
+        // Planes padded with r replicated columns at each side: bit p is the count of column clamp(p - r)
+        uint64_t* padded = counts + (size_t)countBits * rowWords;
+        for (int b = 0; b < countBits; b++) {
+            const uint64_t* plane = counts + (size_t)b * rowWords;
+            uint64_t* out = padded + (size_t)b * paddedWords;
+            for (int w = 0; w < paddedWords; w++)
+                out[w] = shiftedWord(plane, rowWords, w, -r);
+            bool first = (plane[0] & 1) != 0;
+            bool last = ((plane[(width - 1) >> 6] >> ((width - 1) & 63)) & 1) != 0;
+            for (int p = 0; p < r; p++) {
+                if (first)
+                    out[p >> 6] |= (uint64_t)1 << (p & 63);
+                if (last)
+                    out[(r + width + p) >> 6] |= (uint64_t)1 << ((r + width + p) & 63);
+            }
+        }
+
+        // Sum of the k columns of the window of each pixel and comparison with the majority
+        int majority = (k * k + 1) / 2;
+        uint64_t* out = &median[(size_t)y * rowWords];
+        for (int w = 0; w < rowWords; w++) {
+            // The window of the pixels of word w is in words w and w + 1 of the padded planes (k < 64)
+            uint64_t lo[4], hi[4];
+            for (int b = 0; b < countBits; b++) {
+                lo[b] = padded[(size_t)b * paddedWords + w];
+                hi[b] = w + 1 < paddedWords ? padded[(size_t)b * paddedWords + w + 1] : 0;
+            }
+            uint64_t sum[8] = {0};
+            for (int dx = 0; dx < k; dx++) {
+                uint64_t carry = 0;
+                for (int b = 0; b < sumBits; b++) {
+                    uint64_t a = b >= countBits ? 0 : dx == 0 ? lo[b] : (lo[b] >> dx) | (hi[b] << (64 - dx));
+                    uint64_t s = sum[b];
+                    sum[b] = s ^ a ^ carry;
+                    carry = (s & a) | (carry & (s ^ a));
+                }
+            }
+            // sum >= majority, from the most significant bit
+            uint64_t greater = 0, equal = ~(uint64_t)0;
+            for (int b = sumBits - 1; b >= 0; b--) {
+                if ((majority >> b) & 1) {
+                    equal &= sum[b];
+                } else {
+                    greater |= equal & sum[b];
+                    equal &= ~sum[b];
+                }
+            }
+            out[w] = greater | equal;
+        }
+        out[rowWords - 1] &= lastWordMask();
+    }
+
+    /**
+        Dilation of the packed rows: each row is dilated horizontally by every half-width of the element, and each output row is the OR
+        of the rows of its window dilated by the half-width of their row of the element. Rows out of the image are ignored.
+    */
+    void dilateRows(const std::vector<uint64_t>& rows, cv::Point anchor) {
+        // Half-widths used by the element, and the position of each one in the horizontal dilations
+        std::vector<int> widths;
+        for (size_t i = 0; i < halfWidths.size(); i++)
+            if (halfWidths[i] >= 0 && std::find(widths.begin(), widths.end(), halfWidths[i]) == widths.end())
+                widths.push_back(halfWidths[i]);
+        std::sort(widths.begin(), widths.end());
+        int numWidths = (int)widths.size();
+        horizontal.resize((size_t)height * numWidths * rowWords);
+
+        cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; y++) {
+                const uint64_t* row = &rows[(size_t)y * rowWords];
+                uint64_t* out = &horizontal[(size_t)y * numWidths * rowWords];
+                for (int w = 0; w < rowWords; w++) {
+                    // Incremental OR of the shifts: d adds the pixels at distance d of the previous half-width
+                    uint64_t acc = row[w];
+                    int done = 0;
+                    for (int i = 0; i < numWidths; i++) {
+                        for (int d = done + 1; d <= widths[i]; d++)
+                            acc |= shiftedWord(row, rowWords, w, d) | shiftedWord(row, rowWords, w, -d);
+                        done = widths[i];
+                        out[(size_t)i * rowWords + w] = acc;
+                    }
+                }
+                for (int i = 0; i < numWidths; i++)
+                    out[(size_t)i * rowWords + rowWords - 1] &= lastWordMask();
+            }
+        }, bands());
+
+        std::vector<int> widthIndex(halfWidths.size(), -1);
+        for (size_t i = 0; i < halfWidths.size(); i++)
+            if (halfWidths[i] >= 0)
+                widthIndex[i] = (int)(std::find(widths.begin(), widths.end(), halfWidths[i]) - widths.begin());
+
+        cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; y++) {
+                uint64_t* out = &dilated[(size_t)y * rowWords];
+                memset(out, 0, rowWords * sizeof(uint64_t));
+                for (size_t i = 0; i < halfWidths.size(); i++) {
+                    int sourceRow = y + (int)i - anchor.y;
+                    if (widthIndex[i] < 0 || sourceRow < 0 || sourceRow >= height)
+                        continue;
+                    const uint64_t* row = &horizontal[((size_t)sourceRow * numWidths + widthIndex[i]) * rowWords];
+                    for (int w = 0; w < rowWords; w++)
+                        out[w] |= row[w];
+                }
+            }
+        }, bands());
+    }
+
+    // Number of bits of the counts up to n
+    static int bitsFor(int n) {
+        int bits = 1;
+        while ((1 << bits) <= n)
+            bits++;
+        return bits;
+    }
+
+    int width;
+    int height;
+    int rowWords;                       // Words of each packed row
+    std::vector<int> halfWidths;        // Half-width of each row of the element, -1 for empty rows
+    std::vector<uint64_t> source;       // Packed mask
+    std::vector<uint64_t> median;       // Packed median of the mask
+    std::vector<uint64_t> horizontal;   // Packed rows dilated horizontally by each half-width of the element
+    std::vector<uint64_t> dilated;      // Packed result
+};
+
+#endif // BINARY_MORPHOLOGY_H
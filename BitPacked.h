@@ -0,0 +1,210 @@
+/**
+    Bit-packed representation of the binary processed images (1 bit per pixel instead of 1 byte, or 4 bytes as float), used to store,
+    cache and score them. A pixel is set when its value is over 127, so packing a binary mask (0/255) doesn't lose anything.
+    BitplaneScorer scores packed images against a linear model with AND + popcount over its weights quantized to 8 bits.
+*/
+
+#ifndef BIT_PACKED_H
+#define BIT_PACKED_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include "LinearScorer.h"
+
+/**
+    Returns: the number of 64 bits words of a packed sample with numVars pixels.
+*/
+inline int packedWords(int numVars) {
+    return (numVars + 63) / 64;
+}
+
+/**
+    Returns: the number of bits set in a 64 bits word.
+*/
+inline int popcount64(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+    Function that packs a processed image into bits: bit k of the sample is set if pixel k is over 127.
+    Params:
+        mask - The pixels of the processed image (continuous, 8 bits)
+        numVars - Number of pixels
+        out - The packed sample, with packedWords(numVars) words. The bits after the last pixel are 0
+*/
+inline void packMask(const uchar* mask, int numVars, uint64_t* out) {
+    int numWords = packedWords(numVars);
+    int fullWords = numVars / 64;
+    for (int w = 0; w < fullWords; w++, mask += 64) {
+        uint64_t word = 0;
+#if CV_SIMD128
+        for (int k = 0; k < 4; k++)
+            word |= (uint64_t)(unsigned)cv::v_signmask(cv::v_load(mask + 16 * k)) << (16 * k);
+#else
+        for (int k = 0; k < 64; k++)
+            word |= (uint64_t)(mask[k] >> 7) << k;
+#endif
+        out[w] = word;
+    }
+    if (fullWords < numWords) {
+        uint64_t word = 0;
+        for (int k = 0; k < numVars - fullWords * 64; k++)
+            word |= (uint64_t)(mask[k] >> 7) << k;
+        out[fullWords] = word;
+    }
+}
+
+/**
+    Function that packs a row of float features into bits: bit k of the sample is set if feature k is over 127.
+*/
+inline void packMask(const float* features, int numVars, uint64_t* out) {
+    memset(out, 0, packedWords(numVars) * sizeof(uint64_t));
+    for (int k = 0; k < numVars; k++)
+        if (features[k] > 127)
+            out[k >> 6] |= (uint64_t)1 << (k & 63);
+}
+
+/**
+    Function that unpacks a packed sample into a processed image of 0 and 255 values.
+    Params:
+        bits - The packed sample
+        numVars - Number of pixels
+        out - The pixels of the processed image (continuous, 8 bits)
+*/
+inline void unpackMask(const uint64_t* bits, int numVars, uchar* out) {
+    // Pixels of each value of 8 bits, so they are unpacked 8 at a time
+    static const struct ByteTable {
+        uchar pixels[256][8];
+        ByteTable() {
+            for (int v = 0; v < 256; v++)
+                for (int k = 0; k < 8; k++)
+                    pixels[v][k] = (uchar)(0 - ((v >> k) & 1));
+        }
+    } table;
+
+    int fullBytes = numVars / 8;
+    for (int i = 0; i < fullBytes; i++)
+        memcpy(out + 8 * i, table.pixels[(bits[i >> 3] >> (8 * (i & 7))) & 0xFF], 8);
+    for (int k = fullBytes * 8; k < numVars; k++)
+        out[k] = (uchar)(0 - (uchar)((bits[k >> 6] >> (k & 63)) & 1));
+}
+
+/**
+    Function that unpacks a packed sample into a row of float features of 0 and 255 values, as used to train the SVM.
+*/
+inline void unpackMask(const uint64_t* bits, int numVars, float* out) {
+    for (int k = 0; k < numVars; k++)
+        out[k] = ((bits[k >> 6] >> (k & 63)) & 1) ? 255.f : 0.f;
+}
+
+class BitplaneScorer {
+public:
+
+    static const int PLANES = 8;
+
+    BitplaneScorer() : pairCount(0), varCount(0), wordCount(0) {}
+
+    /**
+        Builds the bit-planes of the weights of a linear scorer. The weights of each decision function are quantized to 8 bits
+        (two's complement) and each bit of them is stored as a packed plane, so w*x = sum(2^b * popcount(x & plane_b)) - 128 * popcount(x & plane_7).
+        Params:
+            linear - The linear scorer of the model
+        Returns: true if the scorer could be built.
+    */
+    bool create(const LinearSvmScorer& linear) {
+        pairCount = varCount = wordCount = 0;
+        if (linear.empty())
+            return false;
+
+        int numClasses = linear.getClassCount();
+        int numPairs = numClasses * (numClasses - 1) / 2;
+        int numVars = linear.getVarCount();
+        int numWords = packedWords(numVars);
+
+        scale.resize(numPairs);
+        rho.resize(numPairs);
+        planes.assign((size_t)numWords * numPairs * PLANES, 0);
+        for (int p = 0; p < numPairs; p++) {
+            float maxWeight = 0;
+            for (int j = 0; j < numVars; j++)
+                maxWeight = std::max(maxWeight, std::fabs(linear.weight(p, j)));
+            scale[p] = maxWeight > 0 ? maxWeight / 127.0 : 1.0;
+            rho[p] = linear.getRho(p);
+
+            for (int j = 0; j < numVars; j++) {
+                int q = cvRound(linear.weight(p, j) / scale[p]);
+                uint8_t bits = (uint8_t)(int8_t)std::max(-127, std::min(127, q));
+                for (int b = 0; b < PLANES; b++)
+                    if ((bits >> b) & 1)
+                        planes[((size_t)(j >> 6) * numPairs + p) * PLANES + b] |= (uint64_t)1 << (j & 63);
+            }
+        }
+
+        labels = linear.getClassLabels();
+        pairCount = numPairs;
+        varCount = numVars;
+        wordCount = numWords;
+        return true;
+    }
+
+    bool empty() const { return pairCount == 0; }
+    int getVarCount() const { return varCount; }
+
+    /**
+        Computes the decision values (w*x - rho) of all the decision functions for a packed sample of 0/255 features.
+        Words of the sample without any pixel set are skipped.
+    */
+    void score(const uint64_t* sample, double* scores) const {
+        int counts[LinearSvmScorer::MAX_PAIRS][PLANES];
+        memset(counts, 0, sizeof(counts));
+
+        const uint64_t* plane = &planes[0];
+        for (int w = 0; w < wordCount; w++, plane += pairCount * PLANES) {
+            uint64_t x = sample[w];
+            if (x == 0)
+                continue;
+            for (int p = 0; p < pairCount; p++)
+                for (int b = 0; b < PLANES; b++)
+                    counts[p][b] += popcount64(x & plane[p * PLANES + b]);
+        }
+
+        for (int p = 0; p < pairCount; p++) {
+            long long dot = -128LL * counts[p][PLANES - 1];
+            for (int b = 0; b < PLANES - 1; b++)
+                dot += (long long)counts[p][b] << b;
+            scores[p] = 255.0 * scale[p] * (double)dot - rho[p];
+        }
+    }
+
+    /**
+        Predicts the class of a packed sample.
+        Returns: the label of the predicted class.
+    */
+    int predict(const uint64_t* sample) const {
+        double scores[LinearSvmScorer::MAX_PAIRS];
+        score(sample, scores);
+        return voteOneVsOne(scores, labels);
+    }
+
+private:
+    int pairCount;
+    int varCount;
+    int wordCount;
+    std::vector<double> scale;
+    std::vector<double> rho;
+    std::vector<uint64_t> planes;   // [word][pair][plane]
+    std::vector<int> labels;
+};
+
+#endif // BIT_PACKED_H
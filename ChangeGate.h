@@ -0,0 +1,66 @@
+/**
+    Change-detection gate of the live prediction loops: it decides if a frame has to be processed and predicted, or if the last prediction
+    can be reused because the scene didn't change. The frames are compared by a signature: the frame reduced to a thumbnail of SIGNATURE_WIDTH
+    columns (area interpolation, one read of the frame) and thresholded with the HSV configuration, a tiny version of the mask.
+    The signature is compared with the one of the last evaluated frame (not the previous frame), so slow changes add up until they are evaluated.
+*/
+
+#ifndef CHANGE_GATE_H
+#define CHANGE_GATE_H
+
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "HsvThreshold.h"
+
+class ChangeGate {
+public:
+
+    // Width of the signature of the frames (the height keeps the aspect ratio)
+    static const int SIGNATURE_WIDTH = 32;
+
+    /**
+        Creates the gate.
+        Params:
+            threshold - Fraction of the cells of the signature that have to change for the frame to be evaluated
+    */
+    explicit ChangeGate(double threshold = 0.02) : threshold(threshold) {}
+
+    /**
+        Decides if a frame has changed since the last evaluated one. If it did, the frame becomes the reference of the next ones.
+        Params:
+            frame - The frame (BGR)
+            hsvConfig - The HSV configuration used to process the frames
+        Returns: true if the frame has to be evaluated, false if the last prediction can be reused.
+    */
+    bool changed(const cv::Mat& frame, const int* hsvConfig) {
+        cv::Size size(SIGNATURE_WIDTH, std::max(1, cvRound(frame.rows * SIGNATURE_WIDTH / double(frame.cols))));
+        cv::resize(frame, thumbnail, size, 0, 0, cv::INTER_AREA);
+        thresholdHsv(thumbnail, signature, hsvConfig);
+
+        if (!reference.empty() && reference.size() == signature.size()) {
+            cv::compare(signature, reference, difference, cv::CMP_NE);
+            int changedCells = cv::countNonZero(difference);
+            if (changedCells <= threshold * signature.total())
+                return false;
+        }
+        signature.copyTo(reference);
+        return true;
+    }
+
+    /**
+        Forgets the reference, so the next frame is evaluated (after frames that were skipped without looking at them).
+    */
+    void reset() {
+        reference.release();
+    }
+
+private:
+    double threshold;
+    cv::Mat thumbnail;
+    cv::Mat signature;
+    cv::Mat reference;      // Signature of the last evaluated frame
+    cv::Mat difference;
+};
+
+#endif // CHANGE_GATE_H
@@ -0,0 +1,214 @@
+/**
+    k-fold cross-validation and search of the parameters of the SVM (kernel, C and gamma) over the processed training set.
+    The folds are stratified by class and are only lists of row indices into the same samples matrix (TrainData sampleIdx for training,
+    the rows themselves for validation), so the samples are processed once and never duplicated by the search.
+    Every (parameters, fold) pair is trained in parallel on the work-stealing pool.
+*/
+
+#ifndef CROSS_VALIDATION_H
+#define CROSS_VALIDATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/ml/ml.hpp>
+#include "Model.h"
+#include "ThreadPool.h"
+
+/**
+    Parameters of the SVM model.
+*/
+struct SvmParams {
+    int kernel;     // cv::ml::SVM::LINEAR or cv::ml::SVM::RBF
+    double C;
+    double gamma;   // Only used by the RBF kernel
+
+    SvmParams(int kernel = cv::ml::SVM::LINEAR, double C = 2.67, double gamma = 5.383) : kernel(kernel), C(C), gamma(gamma) {}
+
+    std::string name() const {
+        std::ostringstream text;
+        text << (kernel == cv::ml::SVM::LINEAR ? "LINEAR" : kernel == cv::ml::SVM::RBF ? "RBF" : "OTHER") << " C=" << C;
+        if (kernel != cv::ml::SVM::LINEAR)
+            text << " gamma=" << gamma;
+        return text.str();
+    }
+
+    /**
+        Returns: a new SVM with these parameters, ready to be trained.
+    */
+    cv::Ptr<cv::ml::SVM> createSvm() const {
+        cv::Ptr<cv::ml::SVM> svm = cv::ml::SVM::create();
+        svm->setType(cv::ml::SVM::C_SVC);
+        svm->setC(C);
+        svm->setGamma(gamma);
+        svm->setKernel(kernel);
+        svm->setTermCriteria(cv::TermCriteria(cv::TermCriteria::MAX_ITER, (int)1e7, 1e-6));
+        return svm;
+    }
+};
+
+/**
+    Structure with the results of the cross-validation of one set of parameters.
+*/
+struct CrossValidationResult {
+    SvmParams params;
+    double accuracy;            // Mean accuracy over the folds
+    double accuracyStd;         // Standard deviation of the accuracy over the folds
+    double msPerSample;         // Mean time predicting a validation sample, with the prediction path the program uses
+    double supportVectors;      // Mean number of support vectors
+    double trainSeconds;        // Mean time training a fold
+};
+
+/**
+    Function that builds a grid of parameters: the linear kernel with every C, and the RBF kernel with every C and gamma.
+    The gammas are relative to 1 / (numVars * 255^2), the scale of the squared distances between the 0/255 processed images.
+*/
+inline std::vector<SvmParams> gridSearchParams(int numVars){
+    const double Cs[] = {0.01, 0.1, 1, 2.67, 10, 100};
+    const double gammaFactors[] = {0.1, 1, 10};
+    double gammaBase = 1.0 / (numVars * 255.0 * 255.0);
+    std::vector<SvmParams> grid;
+    for (size_t c = 0; c < sizeof(Cs) / sizeof(Cs[0]); c++)
+        grid.push_back(SvmParams(cv::ml::SVM::LINEAR, Cs[c]));
+    for (size_t c = 0; c < sizeof(Cs) / sizeof(Cs[0]); c++)
+        for (size_t g = 0; g < sizeof(gammaFactors) / sizeof(gammaFactors[0]); g++)
+            grid.push_back(SvmParams(cv::ml::SVM::RBF, Cs[c], gammaFactors[g] * gammaBase));
+    return grid;
+}
+
+/**
+    Function that draws random parameters: the kernel, C log-uniform in [0.001, 1000] and gamma log-uniform in [0.01, 100] / (numVars * 255^2).
+*/
+inline std::vector<SvmParams> randomSearchParams(int numVars, int count, uint64 seed = 12345){
+    cv::RNG rng(seed);
+    double gammaBase = 1.0 / (numVars * 255.0 * 255.0);
+    std::vector<SvmParams> params;
+    for (int i = 0; i < count; i++) {
+        int kernel = rng.uniform(0, 2) == 0 ? cv::ml::SVM::LINEAR : cv::ml::SVM::RBF;
+        double C = std::pow(10.0, rng.uniform(-3.0, 3.0));
+        double gamma = gammaBase * std::pow(10.0, rng.uniform(-2.0, 2.0));
+        params.push_back(SvmParams(kernel, C, gamma));
+    }
+    return params;
+}
+
+/**
+    Function that assigns the samples to k folds, stratified by class (the samples of each class are dealt to the folds in turn).
+    Params:
+        classes - A matrix of one column with the classes of the samples
+        k - Number of folds
+    Returns: the fold of each sample.
+*/
+inline std::vector<int> stratifiedFolds(const cv::Mat& classes, int k){
+    std::vector<int> folds(classes.total());
+    std::vector<int> labels;
+    std::vector<int> counts;
+    for (int i = 0; i < (int)classes.total(); i++) {
+        int label = classes.at<int>(i);
+        size_t c = std::find(labels.begin(), labels.end(), label) - labels.begin();
+        if (c == labels.size()) {
+            labels.push_back(label);
+            counts.push_back(0);
+        }
+        folds[i] = counts[c]++ % k;
+    }
+    return folds;
+}
+
+/**
+    Function that cross-validates every set of parameters and ranks them by accuracy, and by inference cost when the accuracy is the same.
+    Params:
+        data - A matrix with the samples (one per row, 8 bits or float). SVM::train needs float samples, 8 bits ones are converted once for all the folds
+        classes - A matrix of one column with the classes of the samples
+        params - The parameters to evaluate
+        k - Number of folds
+        config - The preprocessing of the samples, stored in the models
+        numThreads - Number of threads of the pool, one per core if it is 0
+    Returns: the results of each set of parameters, from the best to the worst.
+*/
+inline std::vector<CrossValidationResult> crossValidate(const cv::Mat& data, const cv::Mat& classes, const std::vector<SvmParams>& params, int k,
+                                                        const PreprocessConfig& config, int numThreads = 0){
+    std::vector<int> folds = stratifiedFolds(classes, k);
+    cv::Mat samples = data;
+    if (samples.type() != CV_32F)
+        data.convertTo(samples, CV_32F);
+
+    // Indices of the training and validation samples of each fold, views over the same samples matrix
+    std::vector<cv::Mat> trainIdx(k);
+    std::vector<std::vector<int> > validationIdx(k);
+    for (int f = 0; f < k; f++) {
+        std::vector<int> train;
+        for (int i = 0; i < (int)folds.size(); i++)
+            (folds[i] == f ? validationIdx[f] : train).push_back(i);
+        trainIdx[f] = cv::Mat(train, true);
+    }
+
+    // Train and validate every (parameters, fold) pair in parallel
+    int numJobs = (int)params.size() * k;
+    std::vector<double> accuracy(numJobs), msPerSample(numJobs), supportVectors(numJobs), trainSeconds(numJobs);
+    WorkStealingPool pool(numThreads);
+    pool.parallelFor(0, numJobs, [&](int job) {
+        const SvmParams& p = params[job / k];
+        int f = job % k;
+
+        int64 startTicks = cv::getTickCount();
+        HandModel model;
+        model.svm = p.createSvm();
+        model.preprocessing = config;
+        model.svm->train(cv::ml::TrainData::create(samples, cv::ml::ROW_SAMPLE, classes, cv::noArray(), trainIdx[f]));
+        trainSeconds[job] = (cv::getTickCount() - startTicks) / cv::getTickFrequency();
+        setModelClasses(model, classes);
+        supportVectors[job] = model.svm->getSupportVectors().rows;
+
+        int correct = 0;
+        startTicks = cv::getTickCount();
+        for (size_t v = 0; v < validationIdx[f].size(); v++) {
+            int i = validationIdx[f][v];
+            int predicted = !model.scorer.empty() ? model.scorer.predict(samples.ptr<float>(i)) : (int)model.svm->predict(samples.row(i));
+            if (predicted == classes.at<int>(i))
+                correct++;
+        }
+        double ms = (cv::getTickCount() - startTicks) * 1000.0 / cv::getTickFrequency();
+        accuracy[job] = validationIdx[f].empty() ? 0 : correct * 100.0 / validationIdx[f].size();
+        msPerSample[job] = validationIdx[f].empty() ? 0 : ms / validationIdx[f].size();
+    });
+
+    std::vector<CrossValidationResult> results(params.size());
+    for (size_t p = 0; p < params.size(); p++) {
+        CrossValidationResult& r = results[p];
+        r.params = params[p];
+        r.accuracy = r.accuracyStd = r.msPerSample = r.supportVectors = r.trainSeconds = 0;
+        for (int f = 0; f < k; f++) {
+            int job = (int)p * k + f;
+            r.accuracy += accuracy[job] / k;
+            r.msPerSample += msPerSample[job] / k;
+            r.supportVectors += supportVectors[job] / k;
+            r.trainSeconds += trainSeconds[job] / k;
+        }
+        for (int f = 0; f < k; f++)
+            r.accuracyStd += (accuracy[p * k + f] - r.accuracy) * (accuracy[p * k + f] - r.accuracy) / k;
+        r.accuracyStd = std::sqrt(r.accuracyStd);
+    }
+    std::sort(results.begin(), results.end(), [](const CrossValidationResult& a, const CrossValidationResult& b) {
+        return a.accuracy != b.accuracy ? a.accuracy > b.accuracy : a.msPerSample < b.msPerSample;
+    });
+    return results;
+}
+
+/**
+    Function that prints the ranking of the cross-validation.
+*/
+inline void printCrossValidation(std::ostream& out, const std::vector<CrossValidationResult>& results){
+    std::ostringstream text;
+    text << " Rank\tParameters\tAccuracy\tStd\tms/sample\tSupport vectors\tTrain (s)" << std::endl;
+    for (size_t i = 0; i < results.size(); i++)
+        text << " " << i + 1 << "\t" << results[i].params.name() << "\t" << results[i].accuracy << "\t" << results[i].accuracyStd << "\t"
+             << results[i].msPerSample << "\t" << results[i].supportVectors << "\t" << results[i].trainSeconds << std::endl;
+    out << text.str();
+}
+
+#endif // CROSS_VALIDATION_H
@@ -0,0 +1,121 @@
+/**
+    Listing of the images dataset (a folder per class inside images, with .jpg or .png files) and of its division into the training and testing sets.
+*/
+
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "dirent.h"
+
+/**
+    Structure with the information of one image of the dataset: where it is, its class and the set it belongs to.
+*/
+struct DatasetEntry {
+    std::string path;
+    int classImg;
+    bool isTest;
+    long long fileSize;     // Size in bytes of the image file
+    long long modifiedTime; // Last modification time of the image file
+};
+
+/**
+    Function that lists the images (.jpg or .png files) of the folder of a class, dividing them into the training and testing sets (~30% for testing).
+    Params:
+        classPath - The path of the folder of the class
+        classImg - The class of its images
+        entries - The vector where the images are added
+    Returns: true if the folder could be read, false otherwise.
+*/
+inline bool listClassImages(const std::string& classPath, int classImg, std::vector<DatasetEntry>& entries)
+{
+    DIR *dirClass;
+    struct dirent *imgFile;
+    if ((dirClass = opendir (classPath.c_str())) == NULL)
+        return false;
+
+    // Divide the images between testing and training sets
+    int countTest = 1;
+    while ((imgFile = readdir (dirClass)) != NULL) {
+
+        // check if the file extension is .jpg or png
+        bool isImg = imgFile->d_namlen >= 4 && strcmp(imgFile->d_name + imgFile->d_namlen - 4, ".jpg") == 0;
+        isImg = isImg || (imgFile->d_namlen >= 4 && strcmp(imgFile->d_name + imgFile->d_namlen - 4, ".png") == 0);
+        if (isImg){
+            std::stringstream sf;
+            sf << classPath << "\\" << imgFile->d_name;
+
+            // Divide in training and testing sets (takes number 3, 5, and 8 of each 10 images ~30%)
+            // The cross-validation of the parameters (searchSVM) uses k folds of the training set instead of changing this split.
+            DatasetEntry entry;
+            entry.path = sf.str();
+            entry.classImg = classImg;
+            entry.isTest = countTest == 3 || countTest == 5 || countTest == 8;
+
+            // Size and modification time, used to know when a processed image is outdated
+            struct stat fileInfo;
+            if (stat(entry.path.c_str(), &fileInfo) == 0) {
+                entry.fileSize = (long long)fileInfo.st_size;
+                entry.modifiedTime = (long long)fileInfo.st_mtime;
+            } else {
+                entry.fileSize = -1;
+                entry.modifiedTime = -1;
+            }
+            entries.push_back(entry);
+
+            // Reset the counter if we got to 10
+            if(countTest >= 10)
+                countTest = 1;
+            else
+                countTest++;
+        }
+    }
+    closedir (dirClass);
+    return true;
+}
+
+/**
+    Function that loops over the images folder and lists the images of the dataset, dividing them into the training and testing sets (~30% for testing).
+    The images are listed in the order they are read from the folders, which is the order the rows have in the final training and testing sets.
+    Params:
+        entries - The vector where the images of the dataset are added
+        imagesPath - The folder of the dataset, with a folder per class named with its number
+    Returns: true if the images folder could be read, false otherwise.
+*/
+inline bool listDataset(std::vector<DatasetEntry>& entries, const std::string& imagesPath = "images")
+{
+    // Loop over the images folder to list the images of the dataset
+    DIR *dir;
+    struct dirent *ent;
+    if ((dir = opendir ((imagesPath + "\\").c_str())) == NULL) {
+        /* could not open directory */
+        perror ("");
+        return false;
+    }
+
+    // This is the images folder... now we loop through all files and if it is a dir then we go inside
+    printf ("Dir: %s\n", dir->dd_name);
+    while ((ent = readdir (dir)) != NULL) {
+        // Here we are in the files of the images folders
+        if (strcmp(ent->d_name, ".") != 0 & strcmp(ent->d_name, "..") != 0){
+
+            // Path of the file/folder in the images folder
+            std::stringstream ss;
+            ss << imagesPath << "\\" << ent->d_name;
+
+            // if it's a folder then list its images, the name of the folder is the class of the image
+            listClassImages(ss.str(), atoi(ent->d_name), entries);
+        }
+    }
+    closedir (dir);
+
+    return true;
+}
+
+#endif // DATASET_H
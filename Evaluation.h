@@ -0,0 +1,163 @@
+/**
+    Batch evaluation of a model over a whole set (one sample per row): the rows are scored in parallel chunks without copying them,
+    and the result is summarized in a confusion matrix with the accuracy of each class and the time it took.
+*/
+
+#ifndef EVALUATION_H
+#define EVALUATION_H
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "Model.h"
+
+/**
+    Structure with the results of evaluating a model over a set.
+*/
+struct EvaluationResult {
+    std::vector<int> classLabels;   // Labels of the rows and columns of the confusion matrix
+    cv::Mat confusion;              // Number of samples of each true class (rows) predicted as each class (columns)
+    std::vector<int> predictions;   // Predicted class of each sample
+    int correct;
+    int total;
+    double seconds;                 // Time spent predicting the set
+
+    EvaluationResult() : correct(0), total(0), seconds(0) {}
+
+    double accuracy() const {
+        return total > 0 ? correct * 100.0 / total : 0;
+    }
+
+    /**
+        Returns: the percentage of the samples of the class in position c of classLabels that were correctly predicted.
+    */
+    double classAccuracy(int c) const {
+        int samples = 0;
+        for (int k = 0; k < confusion.cols; k++)
+            samples += confusion.at<int>(c, k);
+        return samples > 0 ? confusion.at<int>(c, c) * 100.0 / samples : 0;
+    }
+
+    /**
+        Prints the statistics of the evaluation: matches, accuracy, confusion matrix, accuracy of each class and timing.
+    */
+    void print(std::ostream& out, const std::string& setName) const {
+        std::ostringstream text;
+        text << " " << setName << " Prediction" << std::endl;
+        text << " Number of correct matches: " << correct << std::endl;
+        text << " Accuracy: " << accuracy() << std::endl;
+        text << " Confusion matrix (rows: true class, columns: predicted class)" << std::endl;
+        text << "     ";
+        for (size_t c = 0; c < classLabels.size(); c++)
+            text << "\t" << classLabels[c];
+        text << "\tAccuracy" << std::endl;
+        for (size_t r = 0; r < classLabels.size(); r++) {
+            text << "     " << classLabels[r];
+            for (size_t c = 0; c < classLabels.size(); c++)
+                text << "\t" << confusion.at<int>((int)r, (int)c);
+            text << "\t" << classAccuracy((int)r) << std::endl;
+        }
+        text << " Prediction time: " << seconds * 1000 << " ms (" << (total > 0 ? seconds * 1000 / total : 0) << " ms per sample, "
+             << (seconds > 0 ? total / seconds : 0) << " samples/second)" << std::endl;
+        out << text.str();
+    }
+};
+
+/**
+    Function that compares the predictions of a set with its true classes.
+    Params:
+        modelLabels - The classes of the model
+        trueClasses - The true class of each sample
+        predictions - The predicted class of each sample
+        seconds - The time spent predicting the samples
+        setName - The name of the set, used in the output
+        printRows - If the prediction of every row has to be printed (it is buffered and written at once)
+    Returns: the results of the evaluation.
+*/
+inline EvaluationResult summarizePredictions(const std::vector<int>& modelLabels, const std::vector<int>& trueClasses, const std::vector<int>& predictions,
+                                             double seconds, const std::string& setName, bool printRows = false){
+    EvaluationResult result;
+    result.total = (int)predictions.size();
+    result.predictions = predictions;
+    result.seconds = seconds;
+
+    // Classes of the confusion matrix: the ones of the model and any other found in the set
+    result.classLabels = modelLabels;
+    for (size_t k = 0; k < trueClasses.size(); k++) {
+        int trueClass = trueClasses[k];
+        if (std::find(result.classLabels.begin(), result.classLabels.end(), trueClass) == result.classLabels.end())
+            result.classLabels.push_back(trueClass);
+    }
+    std::sort(result.classLabels.begin(), result.classLabels.end());
+
+    int numClasses = (int)result.classLabels.size();
+    result.confusion = cv::Mat::zeros(numClasses, numClasses, CV_32S);
+    std::ostringstream rows;
+    for (size_t k = 0; k < predictions.size(); k++) {
+        int trueClass = trueClasses[k];
+        int predicted = predictions[k];
+        if (predicted == trueClass)
+            result.correct++;
+
+        int r = (int)(std::find(result.classLabels.begin(), result.classLabels.end(), trueClass) - result.classLabels.begin());
+        int c = (int)(std::find(result.classLabels.begin(), result.classLabels.end(), predicted) - result.classLabels.begin());
+        if (c < numClasses)
+            result.confusion.at<int>(r, c)++;
+
+        if (printRows)
+            rows << setName << "[" << k << "] - True: " << trueClass << " | Predicted: " << predicted << "\n";
+    }
+    if (printRows)
+        std::cout << rows.str() << std::flush;
+
+    return result;
+}
+
+/**
+    Function that predicts every row of a set with a model and compares the predictions with the true classes.
+    The linear scorer of the model reads the rows in place; other models predict each chunk of rows with a single SVM::predict call
+    (8 bits rows are converted to float, or projected if the model has a projection, one chunk at a time).
+    Params:
+        model - The model to evaluate
+        data - A matrix with the samples of the set (one per row, 8 bits or float)
+        classes - A matrix of one column with the true classes of the samples
+        setName - The name of the set, used in the output
+        printRows - If the prediction of every row has to be printed (it is buffered and written at once)
+    Returns: the results of the evaluation.
+*/
+inline EvaluationResult evaluateModel(const HandModel& model, const cv::Mat& data, const cv::Mat& classes, const std::string& setName, bool printRows = false){
+    std::vector<int> predictions(data.rows, 0);
+
+    int64 startTicks = cv::getTickCount();
+    const int chunkSize = 32;
+    int numChunks = (data.rows + chunkSize - 1) / chunkSize;
+    cv::parallel_for_(cv::Range(0, numChunks), [&](const cv::Range& range) {
+        for (int chunk = range.start; chunk < range.end; chunk++) {
+            int first = chunk * chunkSize;
+            int last = std::min(data.rows, first + chunkSize);
+            if (!model.scorer.empty() && data.type() == CV_32F) {
+                for (int k = first; k < last; k++)
+                    predictions[k] = model.scorer.predict(data.ptr<float>(k));
+            } else if (!model.scorer.empty() && data.type() == CV_8U) {
+                for (int k = first; k < last; k++)
+                    predictions[k] = model.scorer.predict(data.ptr<uchar>(k));
+            } else {
+                cv::Mat responses;
+                predictFeatureRows(model, data.rowRange(first, last), responses);
+                for (int k = first; k < last; k++)
+                    predictions[k] = (int)responses.at<float>(k - first);
+            }
+        }
+    });
+    double seconds = (cv::getTickCount() - startTicks) / cv::getTickFrequency();
+
+    std::vector<int> trueClasses(data.rows);
+    for (int k = 0; k < data.rows; k++)
+        trueClasses[k] = classes.at<int>(k);
+    return summarizePredictions(model.classLabels, trueClasses, predictions, seconds, setName, printRows);
+}
+
+#endif // EVALUATION_H
@@ -0,0 +1,230 @@
+/**
+    Binary on-disk cache of the processed images of the dataset (the thresholded masks given by processImage), with their classes and training/testing split.
+    Binary masks are stored bit-packed (1 bit per pixel), the ones of the legacy preprocessing (not binary) with 1 byte per pixel.
+    The cache is memory-mapped when it is loaded, so an unchanged dataset doesn't need to decode and process the JPEG images again.
+    Since version 5 the images are decoded already reduced to the working resolution (see ImageLoader.h), older caches are processed again.
+    It is only valid while every image keeps its size and modification time, and the HSV thresholds, the resolutions of the preprocessing and
+    the cropping of the hand don't change.
+*/
+
+#ifndef FEATURE_CACHE_H
+#define FEATURE_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "BitPacked.h"
+#include "Dataset.h"
+#include "MappedFile.h"
+
+// Header of the cache file, followed by the table of entries, the paths of the images and the processed images (aligned to 64 bytes)
+struct FeatureCacheHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t hsvConfig[6];
+    int32_t workWidth;
+    int32_t width;
+    int32_t height;
+    int32_t cropHand;
+    int32_t packed;
+    uint32_t numEntries;
+    uint64_t pathsOffset;
+    uint64_t dataOffset;
+};
+
+// Information of one processed image of the cache
+struct FeatureCacheEntry {
+    int64_t fileSize;
+    int64_t modifiedTime;
+    int32_t classImg;
+    int32_t isTest;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+static const char FEATURE_CACHE_MAGIC[8] = {'H', 'N', 'C', 'F', 'E', 'A', 'T', '\0'};
+static const uint32_t FEATURE_CACHE_VERSION = 5;
+
+class FeatureCache {
+public:
+
+    FeatureCache() : header(NULL), entries(NULL) {}
+
+    /**
+        Maps a cache file and checks that it corresponds to the current dataset and processing parameters.
+        Params:
+            path - The path of the cache file
+            dataset - The current images of the dataset, as listed by listDataset
+            hsvConfig - The HSV configuration used to process the images: {minH, maxH, minS, maxS, minV, maxV}
+            workWidth - The working resolution used to process the images
+            size - The size of the processed images
+            cropHand - If the hand was cropped from the images
+            packed - If the processed images are binary and stored bit-packed
+        Returns: true if the cache can be used, false if it doesn't exist or is outdated.
+    */
+    bool open(const std::string& path, const std::vector<DatasetEntry>& dataset, const int* hsvConfig, int workWidth, cv::Size size, bool cropHand, bool packed) {
+        header = NULL;
+        entries = NULL;
+        if (!file.open(path))
+            return false;
+
+        // Check the header against the processing parameters
+        if (file.size() < sizeof(FeatureCacheHeader))
+            return fail();
+        const FeatureCacheHeader* h = (const FeatureCacheHeader*)file.data();
+        if (memcmp(h->magic, FEATURE_CACHE_MAGIC, sizeof(h->magic)) != 0 || h->version != FEATURE_CACHE_VERSION)
+            return fail();
+        for (int i = 0; i < 6; i++)
+            if (h->hsvConfig[i] != hsvConfig[i])
+                return fail();
+        if (h->workWidth != workWidth || h->width != size.width || h->height != size.height || (h->cropHand != 0) != cropHand
+                || (h->packed != 0) != packed || h->numEntries != dataset.size())
+            return fail();
+
+        // Check the layout against the mapped size before reading any entry (a truncated or corrupt file is rebuilt)
+        uint64_t sampleSize = sampleBytes(h->width * h->height, packed);
+        if (h->pathsOffset != sizeof(FeatureCacheHeader) + (uint64_t)h->numEntries * sizeof(FeatureCacheEntry)
+                || h->dataOffset < h->pathsOffset || h->dataOffset > file.size()
+                || sampleSize * h->numEntries > file.size() - h->dataOffset)
+            return fail();
+
+        // Check every entry against the current images
+        const FeatureCacheEntry* e = (const FeatureCacheEntry*)(file.data() + sizeof(FeatureCacheHeader));
+        const char* paths = (const char*)file.data() + h->pathsOffset;
+        for (size_t i = 0; i < dataset.size(); i++) {
+            const DatasetEntry& d = dataset[i];
+            if (e[i].fileSize != d.fileSize || e[i].modifiedTime != d.modifiedTime || d.fileSize < 0)
+                return fail();
+            if (e[i].classImg != d.classImg || (e[i].isTest != 0) != d.isTest)
+                return fail();
+            if (e[i].pathLength != d.path.size() || h->pathsOffset + (uint64_t)e[i].pathOffset + e[i].pathLength > h->dataOffset
+                    || memcmp(paths + e[i].pathOffset, d.path.c_str(), d.path.size()) != 0)
+                return fail();
+        }
+
+        header = h;
+        entries = e;
+        return true;
+    }
+
+    bool isPacked() const {
+        return header->packed != 0;
+    }
+
+    /**
+        Returns: the processed image i of a cache that is not packed, as a matrix pointing to the mapped file (it is valid while the cache is open).
+    */
+    cv::Mat sample(int i) const {
+        size_t sampleSize = (size_t)header->width * header->height;
+        return cv::Mat(header->height, header->width, CV_8U, (void*)(file.data() + header->dataOffset + sampleSize * i));
+    }
+
+    /**
+        Returns: the bits of the processed image i of a packed cache, pointing to the mapped file (it is valid while the cache is open).
+    */
+    const uint64_t* packedSample(int i) const {
+        size_t sampleSize = sampleBytes(header->width * header->height, true);
+        return (const uint64_t*)(file.data() + header->dataOffset + sampleSize * i);
+    }
+
+    /**
+        Writes a new cache file. It is written in a temporary file and then renamed, so a failed write never leaves a broken cache.
+        Params:
+            path - The path of the cache file
+            dataset - The images of the dataset, as listed by listDataset
+            hsvConfig - The HSV configuration used to process the images: {minH, maxH, minS, maxS, minV, maxV}
+            workWidth - The working resolution used to process the images
+            size - The size of the processed images
+            cropHand - If the hand was cropped from the images
+            packed - If the processed images are binary and have to be stored bit-packed
+            processed - The processed images (8 bits, one channel), in the same order as the dataset
+        Returns: true if the cache was written, false otherwise.
+    */
+    static bool write(const std::string& path, const std::vector<DatasetEntry>& dataset, const int* hsvConfig, int workWidth, cv::Size size,
+                      bool cropHand, bool packed, const std::vector<cv::Mat>& processed) {
+        std::string tmpPath = path + ".tmp";
+        std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+            return false;
+
+        // Table of entries and paths
+        std::vector<FeatureCacheEntry> table(dataset.size());
+        std::string paths;
+        for (size_t i = 0; i < dataset.size(); i++) {
+            table[i].fileSize = dataset[i].fileSize;
+            table[i].modifiedTime = dataset[i].modifiedTime;
+            table[i].classImg = dataset[i].classImg;
+            table[i].isTest = dataset[i].isTest ? 1 : 0;
+            table[i].pathOffset = (uint32_t)paths.size();
+            table[i].pathLength = (uint32_t)dataset[i].path.size();
+            paths += dataset[i].path;
+        }
+
+        FeatureCacheHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, FEATURE_CACHE_MAGIC, sizeof(h.magic));
+        h.version = FEATURE_CACHE_VERSION;
+        for (int i = 0; i < 6; i++)
+            h.hsvConfig[i] = hsvConfig[i];
+        h.workWidth = workWidth;
+        h.width = size.width;
+        h.height = size.height;
+        h.cropHand = cropHand ? 1 : 0;
+        h.packed = packed ? 1 : 0;
+        h.numEntries = (uint32_t)dataset.size();
+        h.pathsOffset = sizeof(FeatureCacheHeader) + sizeof(FeatureCacheEntry) * table.size();
+        h.dataOffset = (h.pathsOffset + paths.size() + 63) / 64 * 64;
+
+        out.write((const char*)&h, sizeof(h));
+        if (!table.empty())
+            out.write((const char*)&table[0], sizeof(FeatureCacheEntry) * table.size());
+        out.write(paths.data(), paths.size());
+        std::string padding((size_t)(h.dataOffset - h.pathsOffset - paths.size()), '\0');
+        out.write(padding.data(), padding.size());
+
+        // Processed images, one after the other
+        std::vector<uint64_t> bits(packedWords(size.area()));
+        for (size_t i = 0; i < processed.size(); i++) {
+            const cv::Mat& img = processed[i];
+            if (img.size() != size || img.type() != CV_8U || !img.isContinuous()) {
+                out.close();
+                remove(tmpPath.c_str());
+                return false;
+            }
+            if (packed) {
+                packMask(img.ptr<uchar>(), size.area(), &bits[0]);
+                out.write((const char*)&bits[0], bits.size() * sizeof(uint64_t));
+            } else {
+                out.write((const char*)img.ptr<uchar>(), size.area());
+            }
+        }
+
+        out.close();
+        if (!out) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+        remove(path.c_str());
+        return rename(tmpPath.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    static size_t sampleBytes(int numVars, bool packed) {
+        return packed ? packedWords(numVars) * sizeof(uint64_t) : (size_t)numVars;
+    }
+
+    bool fail() {
+        file.close();
+        return false;
+    }
+
+    MappedFile file;
+    const FeatureCacheHeader* header;
+    const FeatureCacheEntry* entries;
+};
+
+#endif // FEATURE_CACHE_H
@@ -0,0 +1,305 @@
+/**
+    Feature extractors: the descriptors of the processed images (the masks given by processImage) that the models are trained with.
+    "raw" is the mask itself, one feature per pixel, read in place by the scorers. The others are compact descriptors computed from the mask:
+    "hog" (histograms of oriented gradients of the mask reduced to 64x48), "moments" (Hu and Zernike moments) and "contour" (shape statistics of the
+    largest contour, its convex hull and its convexity defects, like the number of raised fingers).
+    The extractor is chosen by name in the preprocessing configuration, so it is stored with the model and the training and the predictions always use the same.
+*/
+
+#ifndef FEATURE_EXTRACTOR_H
+#define FEATURE_EXTRACTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/objdetect/objdetect.hpp>
+
+class FeatureExtractor {
+public:
+    virtual ~FeatureExtractor() {}
+
+    /**
+        Returns: the name of the extractor, as it is stored in the model.
+    */
+    virtual std::string name() const = 0;
+
+    /**
+        Returns: the number of features of a mask of the given size.
+    */
+    virtual int size(cv::Size maskSize) const = 0;
+
+    /**
+        Computes the features of a mask.
+        Params:
+            mask - The processed image (8 bits, one channel, 0 for the background)
+            out - The features, size(mask.size()) values
+    */
+    virtual void compute(const cv::Mat& mask, float* out) const = 0;
+
+    /**
+        Returns: true if the features are the 8 bits pixels of the mask, so they don't need to be computed nor converted.
+    */
+    virtual bool isRaw() const { return false; }
+};
+
+/**
+    The pixels of the mask.
+*/
+class RawFeatures : public FeatureExtractor {
+public:
+    std::string name() const { return "raw"; }
+    int size(cv::Size maskSize) const { return maskSize.area(); }
+    void compute(const cv::Mat& mask, float* out) const {
+        cv::Mat row(1, (int)mask.total(), CV_32F, out);
+        mask.reshape(1, 1).convertTo(row, CV_32F);
+    }
+    bool isRaw() const { return true; }
+};
+
+/**
+    Histograms of oriented gradients of the mask reduced to 64x48: blocks of 16x16 pixels every 8 pixels, cells of 8x8 pixels and 9 orientations
+    (35 blocks of 36 values, 1260 features).
+*/
+class HogFeatures : public FeatureExtractor {
+public:
+    HogFeatures() : hog(cv::Size(64, 48), cv::Size(16, 16), cv::Size(8, 8), cv::Size(8, 8), 9) {}
+
+    std::string name() const { return "hog"; }
+    int size(cv::Size) const { return (int)hog.getDescriptorSize(); }
+    void compute(const cv::Mat& mask, float* out) const {
+        cv::Mat small;
+        cv::resize(mask, small, hog.winSize, 0, 0, cv::INTER_AREA);
+        std::vector<float> descriptor;
+        hog.compute(small, descriptor);
+        std::copy(descriptor.begin(), descriptor.end(), out);
+    }
+
+private:
+    cv::HOGDescriptor hog;
+};
+
+/**
+    The 7 Hu moments (as -sign(h) * log10(|h|) / 10) and the magnitudes of the Zernike moments up to order 8 relative to the one of order 0 (24 values),
+    computed over the mask reduced to 64 pixels of width, in the disk centered on the centroid that contains the hand.
+    Both are invariant to the position, the scale and the rotation of the hand.
+*/
+class MomentFeatures : public FeatureExtractor {
+public:
+    static const int ZERNIKE_ORDER = 8;
+
+    MomentFeatures() {
+        // Coefficients of the radial polynomials: R_nm(rho) = sum_s (-1)^s (n-s)! / (s! ((n+m)/2-s)! ((n-m)/2-s)!) rho^(n-2s)
+        for (int n = 0; n <= ZERNIKE_ORDER; n++) {
+            for (int m = n % 2; m <= n; m += 2) {
+                Polynomial poly;
+                poly.n = n;
+                poly.m = m;
+                poly.coefficients.assign(n + 1, 0.0);
+                for (int s = 0; s <= (n - m) / 2; s++)
+                    poly.coefficients[n - 2 * s] = (s % 2 ? -1 : 1) * factorial(n - s) / (factorial(s) * factorial((n + m) / 2 - s) * factorial((n - m) / 2 - s));
+                polynomials.push_back(poly);
+            }
+        }
+    }
+
+    std::string name() const { return "moments"; }
+    int size(cv::Size) const { return 7 + (int)polynomials.size() - 1; }
+
+    void compute(const cv::Mat& mask, float* out) const {
+        int numFeatures = size(mask.size());
+        std::fill(out, out + numFeatures, 0.f);
+
+        // Hu moments of the whole mask
+        cv::Moments m = cv::moments(mask, true);
+        if (m.m00 <= 0)
+            return;
+        double hu[7];
+        cv::HuMoments(m, hu);
+        for (int k = 0; k < 7; k++)
+            out[k] = hu[k] == 0 ? 0.f : (float)(-(hu[k] > 0 ? 1 : -1) * std::log10(std::fabs(hu[k])) / 10);
+
+        // Zernike moments over the reduced mask, in the smallest disk centered on the centroid that contains the hand
+        cv::Mat small;
+        int width = std::min(64, mask.cols);
+        cv::resize(mask, small, cv::Size(width, std::max(1, cvRound(mask.rows * width / double(mask.cols)))), 0, 0, cv::INTER_AREA);
+        cv::Moments sm = cv::moments(small, false);
+        if (sm.m00 <= 0)
+            return;
+        double cx = sm.m10 / sm.m00, cy = sm.m01 / sm.m00;
+        double radius = 0;
+        for (int y = 0; y < small.rows; y++)
+            for (int x = 0; x < small.cols; x++)
+                if (small.at<uchar>(y, x))
+                    radius = std::max(radius, std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy)));
+        radius += 0.5;
+
+        std::vector<std::complex<double> > z(polynomials.size());
+        double rhoPowers[ZERNIKE_ORDER + 1];
+        std::complex<double> anglePowers[ZERNIKE_ORDER + 1];
+        for (int y = 0; y < small.rows; y++) {
+            for (int x = 0; x < small.cols; x++) {
+                double f = small.at<uchar>(y, x) / 255.0;
+                if (f == 0)
+                    continue;
+                double dx = (x - cx) / radius, dy = (y - cy) / radius;
+                double rho = std::sqrt(dx * dx + dy * dy);
+                std::complex<double> angle = rho > 0 ? std::complex<double>(dx, -dy) / rho : std::complex<double>(1, 0);
+                rhoPowers[0] = 1;
+                anglePowers[0] = 1;
+                for (int k = 1; k <= ZERNIKE_ORDER; k++) {
+                    rhoPowers[k] = rhoPowers[k - 1] * rho;
+                    anglePowers[k] = anglePowers[k - 1] * angle;
+                }
+                for (size_t p = 0; p < polynomials.size(); p++) {
+                    double r = 0;
+                    for (int k = polynomials[p].m; k <= polynomials[p].n; k += 2)
+                        r += polynomials[p].coefficients[k] * rhoPowers[k];
+                    z[p] += f * r * anglePowers[polynomials[p].m];
+                }
+            }
+        }
+        double z00 = std::abs(z[0]);
+        for (size_t p = 1; p < polynomials.size(); p++)
+            out[7 + p - 1] = (float)((polynomials[p].n + 1) * std::abs(z[p]) / z00);
+    }
+
+private:
+    struct Polynomial {
+        int n;
+        int m;
+        std::vector<double> coefficients;   // Coefficient of each power of rho
+    };
+
+    static double factorial(int n) {
+        double f = 1;
+        for (int k = 2; k <= n; k++)
+            f *= k;
+        return f;
+    }
+
+    std::vector<Polynomial> polynomials;    // (n, m) with m <= n and n - m even, (0, 0) first
+};
+
+/**
+    Shape statistics of the largest contour of the mask (13 features, all of them about the [0, 1] range):
+    area, solidity (area / hull area), extent (area / bounding box area), aspect ratio, circularity, elongation, position of the centroid in the
+    bounding box, number of raised fingers, number of convexity defects, mean and maximum depth of the defects, and number of blobs.
+*/
+class ContourFeatures : public FeatureExtractor {
+public:
+    std::string name() const { return "contour"; }
+    int size(cv::Size) const { return 13; }
+
+    void compute(const cv::Mat& mask, float* out) const {
+        std::fill(out, out + 13, 0.f);
+
+        // findContours modifies its input in the older versions of OpenCV
+        cv::Mat work = mask.clone();
+        std::vector<std::vector<cv::Point> > contours;
+        cv::findContours(work, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+        int largest = -1, blobs = 0;
+        double largestArea = 0;
+        for (size_t c = 0; c < contours.size(); c++) {
+            double area = cv::contourArea(contours[c]);
+            if (area > 0.01 * mask.total())
+                blobs++;
+            if (area > largestArea) {
+                largestArea = area;
+                largest = (int)c;
+            }
+        }
+        if (largest < 0 || contours[largest].size() < 4)
+            return;
+        const std::vector<cv::Point>& contour = contours[largest];
+
+        std::vector<int> hullIdx;
+        cv::convexHull(contour, hullIdx, false, false);
+        std::vector<cv::Point> hull;
+        for (size_t k = 0; k < hullIdx.size(); k++)
+            hull.push_back(contour[hullIdx[k]]);
+        double hullArea = cv::contourArea(hull);
+        cv::Rect box = cv::boundingRect(contour);
+        double perimeter = cv::arcLength(contour, true);
+        double handSize = std::max(box.width, box.height);
+
+        // Elongation from the eigenvalues of the second order central moments
+        cv::Moments m = cv::moments(contour);
+        double common = std::sqrt(4 * m.mu11 * m.mu11 + (m.mu20 - m.mu02) * (m.mu20 - m.mu02));
+        double major = m.mu20 + m.mu02 + common, minor = m.mu20 + m.mu02 - common;
+
+        // Convexity defects: the deep ones with an acute angle are the gaps between raised fingers.
+        // convexityDefects throws on self-intersecting contours, which then have no defect features
+        int defects = 0, fingerGaps = 0;
+        double sumDepth = 0, maxDepth = 0;
+        std::vector<cv::Vec4i> convexityDefects;
+        if (hullIdx.size() > 3) {
+            try {
+                cv::convexityDefects(contour, hullIdx, convexityDefects);
+            } catch (const cv::Exception&) {
+                convexityDefects.clear();
+            }
+            for (size_t k = 0; k < convexityDefects.size(); k++) {
+                double depth = convexityDefects[k][3] / 256.0;
+                if (depth < 0.05 * handSize)
+                    continue;
+                defects++;
+                sumDepth += depth;
+                maxDepth = std::max(maxDepth, depth);
+                cv::Point start = contour[convexityDefects[k][0]], end = contour[convexityDefects[k][1]], far = contour[convexityDefects[k][2]];
+                double a = std::hypot(end.x - start.x, end.y - start.y);
+                double b = std::hypot(far.x - start.x, far.y - start.y);
+                double c = std::hypot(end.x - far.x, end.y - far.y);
+                if (depth > 0.15 * handSize && b > 0 && c > 0 && (b * b + c * c - a * a) / (2 * b * c) > 0)
+                    fingerGaps++;
+            }
+        }
+
+        out[0] = (float)(largestArea / mask.total());
+        out[1] = (float)(hullArea > 0 ? largestArea / hullArea : 0);
+        out[2] = (float)(largestArea / std::max(1, box.area()));
+        out[3] = (float)(std::min(4.0, box.width / double(std::max(1, box.height))) / 4);
+        out[4] = (float)(perimeter > 0 ? 4 * CV_PI * largestArea / (perimeter * perimeter) : 0);
+        out[5] = (float)(major > 0 ? 1 - std::sqrt(std::max(0.0, minor) / major) : 0);
+        out[6] = (float)(m.m00 > 0 ? (m.m10 / m.m00 - box.x) / std::max(1, box.width) : 0);
+        out[7] = (float)(m.m00 > 0 ? (m.m01 / m.m00 - box.y) / std::max(1, box.height) : 0);
+        out[8] = (float)((fingerGaps > 0 ? fingerGaps + 1 : 0) / 5.0);
+        out[9] = (float)(defects / 10.0);
+        out[10] = (float)(defects > 0 ? sumDepth / defects / handSize : 0);
+        out[11] = (float)(maxDepth / handSize);
+        out[12] = (float)(blobs / 5.0);
+    }
+};
+
+/**
+    Function that gives the extractor of a name.
+    Returns: the extractor (shared, it can be used from several threads), NULL if there is none with that name.
+*/
+inline const FeatureExtractor* getFeatureExtractor(const std::string& name){
+    static const RawFeatures raw;
+    static const HogFeatures hog;
+    static const MomentFeatures moments;
+    static const ContourFeatures contour;
+    static const FeatureExtractor* extractors[] = {&raw, &hog, &moments, &contour};
+    for (size_t i = 0; i < sizeof(extractors) / sizeof(extractors[0]); i++)
+        if (extractors[i]->name() == name)
+            return extractors[i];
+    return NULL;
+}
+
+/**
+    Returns: the names of all the extractors.
+*/
+inline std::vector<std::string> featureExtractorNames(){
+    std::vector<std::string> names;
+    names.push_back("raw");
+    names.push_back("hog");
+    names.push_back("moments");
+    names.push_back("contour");
+    return names;
+}
+
+#endif // FEATURE_EXTRACTOR_H
@@ -0,0 +1,182 @@
+/**
+    Sources of the frames predicted by the program: the camera, a video file or a folder of images.
+    The folder can be the dataset (a folder per class, like images) or the folder of one class (like images\3), and then the number of the class folder
+    of each image is its true class, so the predictions can be checked. The camera and the video files have no true class, unless one is given.
+*/
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <cctype>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/videoio/videoio.hpp>
+#include "Dataset.h"
+#include "ImageLoader.h"
+
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    /**
+        Reads the next frame.
+        Params:
+            frame - The frame read
+            label - The true class of the frame, or -1 if it is not known
+        Returns: true if a frame was read, false if the source ended (or failed).
+    */
+    virtual bool read(cv::Mat& frame, int& label) = 0;
+
+    /**
+        Returns: true if the source is ready to read frames.
+    */
+    virtual bool isOpened() const = 0;
+
+    /**
+        Returns: the frames per second the source should be replayed at, or 0 if it gives the frames at its own pace (the camera).
+    */
+    virtual double fps() const = 0;
+
+    /**
+        Returns: a description of the source, for the output.
+    */
+    virtual std::string name() const = 0;
+
+    /**
+        Returns: true if the frames are images taken like the ones of the dataset, so they are thresholded with the HSV values of the training.
+    */
+    virtual bool usesDatasetThreshold() const { return false; }
+
+    /**
+        Sets the working resolution of the preprocessing of the model the frames are predicted with, so sources that decode images
+        can decode them already reduced (0, the default, decodes the full resolution).
+    */
+    virtual void setWorkWidth(int workWidth) {}
+};
+
+/**
+    Frames of a camera.
+*/
+class CameraSource : public FrameSource {
+public:
+    explicit CameraSource(int device = 0) : cap(device), device(device) {}
+
+    bool read(cv::Mat& frame, int& label) {
+        label = -1;
+        return cap.read(frame);
+    }
+    bool isOpened() const { return cap.isOpened(); }
+    double fps() const { return 0; }
+    std::string name() const {
+        std::stringstream ss;
+        ss << "camera " << device;
+        return ss.str();
+    }
+
+private:
+    cv::VideoCapture cap;
+    int device;
+};
+
+/**
+    Frames of a video file. All of them have the same true class, if it is given.
+*/
+class VideoFileSource : public FrameSource {
+public:
+    explicit VideoFileSource(const std::string& path, int label = -1) : cap(path), path(path), label(label) {}
+
+    bool read(cv::Mat& frame, int& frameLabel) {
+        frameLabel = label;
+        return cap.read(frame);
+    }
+    bool isOpened() const { return cap.isOpened(); }
+    double fps() const {
+        double videoFps = cap.get(cv::CAP_PROP_FPS);
+        return videoFps > 0 ? videoFps : 30;
+    }
+    std::string name() const { return "video " + path; }
+
+private:
+    mutable cv::VideoCapture cap;   // VideoCapture::get is not const
+    std::string path;
+    int label;
+};
+
+/**
+    Frames of the images of a folder, in the order they are listed, with their class taken from the name of their class folder.
+*/
+class ImageFolderSource : public FrameSource {
+public:
+
+    /**
+        Lists the images of the folder.
+        Params:
+            path - The folder: a dataset with a folder per class, or the folder of a single class
+            replayFps - The frames per second the images should be replayed at
+    */
+    explicit ImageFolderSource(const std::string& path, double replayFps = 30) : path(path), replayFps(replayFps), workWidth(0), next(0) {
+        listDataset(entries, path);
+        if (entries.empty()) {
+            // It is the folder of one class, named with its number
+            size_t slash = path.find_last_of("\\/");
+            std::string folder = slash == std::string::npos ? path : path.substr(slash + 1);
+            int label = !folder.empty() && isdigit((unsigned char)folder[0]) ? atoi(folder.c_str()) : -1;
+            listClassImages(path, label, entries);
+        }
+    }
+
+    bool read(cv::Mat& frame, int& label) {
+        while (next < entries.size()) {
+            const DatasetEntry& entry = entries[next++];
+            label = entry.classImg;
+            if (readImage(entry.path, workWidth, frame))
+                return true;
+        }
+        return false;
+    }
+    bool isOpened() const { return !entries.empty(); }
+    double fps() const { return replayFps; }
+    std::string name() const { return "images " + path; }
+    bool usesDatasetThreshold() const { return true; }
+    void setWorkWidth(int width) { workWidth = width; }
+
+    /**
+        Returns: the number of images of the folder.
+    */
+    int size() const { return (int)entries.size(); }
+
+private:
+    std::string path;
+    double replayFps;
+    int workWidth;
+    std::vector<DatasetEntry> entries;
+    size_t next;
+};
+
+/**
+    Function that opens the source of frames given by its description.
+    Params:
+        source - "camera" (or a number) for a camera, the path of a folder for its images, or the path of a video file
+    Returns: the source, that has to be checked with isOpened.
+*/
+inline cv::Ptr<FrameSource> openFrameSource(const std::string& source){
+    if (source.empty() || source == "camera")
+        return cv::makePtr<CameraSource>(0);
+    bool isNumber = true;
+    for (size_t i = 0; i < source.size(); i++)
+        isNumber = isNumber && isdigit((unsigned char)source[i]);
+    if (isNumber)
+        return cv::makePtr<CameraSource>(atoi(source.c_str()));
+
+    DIR* dir = opendir(source.c_str());
+    if (dir != NULL) {
+        closedir(dir);
+        return cv::makePtr<ImageFolderSource>(source);
+    }
+    return cv::makePtr<VideoFileSource>(source);
+}
+
+#endif // FRAME_SOURCE_H
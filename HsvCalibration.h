@@ -0,0 +1,237 @@
+/**
+    Interactive calibration of the HSV configuration. Each frame is converted to HSV only once, when it is captured; moving the sliders only
+    rebuilds three tables of 256 entries (one per channel), and the preview thresholds the cached HSV pixels with them, the same result as
+    cv::inRange without converting the frame again (nor rebuilding the 2 MB table of thresholdHsv on every move).
+    The pixels of the frames labelled as foreground (the hand) or background are added to two 3D histograms of HSV, from which the automatic
+    mode picks the box of thresholds that best separates them.
+*/
+
+#ifndef HSV_CALIBRATION_H
+#define HSV_CALIBRATION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+class HsvCalibration {
+public:
+
+    // Each bin of the histograms holds 4 consecutive values of a channel (H goes up to 179, S and V up to 255)
+    static const int BIN_SHIFT = 2;
+    static const int H_BINS = 180 >> BIN_SHIFT;
+    static const int S_BINS = 256 >> BIN_SHIFT;
+    static const int V_BINS = 256 >> BIN_SHIFT;
+
+    // Values of the label masks
+    static const uchar BACKGROUND = 0;
+    static const uchar FOREGROUND = 255;
+
+    HsvCalibration() : foreground((size_t)H_BINS * S_BINS * V_BINS, 0), background((size_t)H_BINS * S_BINS * V_BINS, 0),
+                       foregroundCount(0), backgroundCount(0) {}
+
+    /**
+        Sets the frame being calibrated: it is converted to HSV once, and every preview of it reuses the conversion.
+        Params:
+            frame - The frame (BGR)
+    */
+    void setFrame(const cv::Mat& frame) {
+        cv::cvtColor(frame, hsv, CV_BGR2HSV);
+    }
+
+    /**
+        Returns: true if there is a frame to preview.
+    */
+    bool hasFrame() const {
+        return !hsv.empty();
+    }
+
+    /**
+        Thresholds the current frame with a HSV configuration, as cv::inRange would do over its HSV conversion.
+        Params:
+            hsvConfig - The HSV Configuration to apply the threshold: {minH, maxH, minS, maxS, minV, maxV}
+            mask - The output mask, with 255 for the pixels inside the HSV range and 0 for the rest
+    */
+    void preview(const int* hsvConfig, cv::Mat& mask) const {
+        CV_Assert(!hsv.empty());
+        uchar tables[3][256];
+        for (int c = 0; c < 3; c++)
+            for (int value = 0; value < 256; value++)
+                tables[c][value] = (uchar)(hsvConfig[2 * c] <= value && value <= hsvConfig[2 * c + 1] ? 255 : 0);
+
+        mask.create(hsv.rows, hsv.cols, CV_8U);
+        cv::parallel_for_(cv::Range(0, hsv.rows), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; y++) {
+                const uchar* p = hsv.ptr<uchar>(y);
+                uchar* out = mask.ptr<uchar>(y);
+                for (int x = 0; x < hsv.cols; x++, p += 3)
+                    out[x] = tables[0][p[0]] & tables[1][p[1]] & tables[2][p[2]];
+            }
+        });
+    }
+
+    /**
+        Adds the labelled pixels of the current frame to the histograms of the foreground and the background.
+        Params:
+            labels - A mask of the size of the frame with FOREGROUND, BACKGROUND or any other value for the pixels that are not labelled
+    */
+    void addLabels(const cv::Mat& labels) {
+        CV_Assert(!hsv.empty() && labels.type() == CV_8U && labels.size() == hsv.size());
+        for (int y = 0; y < hsv.rows; y++) {
+            const uchar* p = hsv.ptr<uchar>(y);
+            const uchar* l = labels.ptr<uchar>(y);
+            for (int x = 0; x < hsv.cols; x++, p += 3) {
+                if (l[x] != FOREGROUND && l[x] != BACKGROUND)
+                    continue;
+                size_t bin = ((size_t)(p[0] >> BIN_SHIFT) * S_BINS + (p[1] >> BIN_SHIFT)) * V_BINS + (p[2] >> BIN_SHIFT);
+                if (l[x] == FOREGROUND) {
+                    foreground[bin]++;
+                    foregroundCount++;
+                } else {
+                    background[bin]++;
+                    backgroundCount++;
+                }
+            }
+        }
+    }
+
+    /**
+        Forgets the labelled pixels.
+    */
+    void resetLabels() {
+        std::fill(foreground.begin(), foreground.end(), 0);
+        std::fill(background.begin(), background.end(), 0);
+        foregroundCount = 0;
+        backgroundCount = 0;
+    }
+
+    /**
+        Returns: the number of labelled pixels of the foreground.
+    */
+    int64_t getForegroundCount() const {
+        return foregroundCount;
+    }
+
+    /**
+        Picks the thresholds from the labelled pixels: the box of HSV bins that maximizes the fraction of the foreground inside it minus
+        the fraction of the background inside it. It starts from the 5% and 95% percentiles of the foreground in each channel and then
+        moves both bounds of one channel at a time to their best position (every pair of bins, with the summed histograms) until nothing improves.
+        Params:
+            hsvConfig - The HSV Configuration found: {minH, maxH, minS, maxS, minV, maxV}
+        Returns: true if there were foreground and background pixels to pick the thresholds, false otherwise (hsvConfig is not changed).
+    */
+    bool fitThresholds(int* hsvConfig) const {
+        if (foregroundCount == 0 || backgroundCount == 0)
+            return false;
+        std::vector<int64_t> fgSums, bgSums;
+        summedVolume(foreground, fgSums);
+        summedVolume(background, bgSums);
+
+        const int bins[3] = {H_BINS, S_BINS, V_BINS};
+        int lo[3], hi[3];
+        for (int c = 0; c < 3; c++)
+            percentiles(foreground, foregroundCount, c, lo[c], hi[c]);
+
+        double best = separation(fgSums, bgSums, lo, hi);
+        for (int round = 0; round < 10; round++) {
+            bool improved = false;
+            for (int c = 0; c < 3; c++) {
+                int bestLo = lo[c], bestHi = hi[c];
+                for (lo[c] = 0; lo[c] < bins[c]; lo[c]++) {
+                    for (hi[c] = lo[c]; hi[c] < bins[c]; hi[c]++) {
+                        double value = separation(fgSums, bgSums, lo, hi);
+                        if (value > best + 1e-12) {
+                            best = value;
+                            bestLo = lo[c];
+                            bestHi = hi[c];
+                            improved = true;
+                        }
+                    }
+                }
+                lo[c] = bestLo;
+                hi[c] = bestHi;
+            }
+            if (!improved)
+                break;
+        }
+
+        for (int c = 0; c < 3; c++) {
+            hsvConfig[2 * c] = lo[c] << BIN_SHIFT;
+            hsvConfig[2 * c + 1] = ((hi[c] + 1) << BIN_SHIFT) - 1;
+        }
+        return true;
+    }
+
+private:
+    cv::Mat hsv;                        // HSV conversion of the current frame
+    std::vector<int> foreground;        // Histograms of the labelled pixels, indexed by [h][s][v] bins
+    std::vector<int> background;
+    int64_t foregroundCount;
+    int64_t backgroundCount;
+
+    /**
+        Builds the summed volume of a histogram: sums[(h+1)][(s+1)][(v+1)] holds the pixels of all the bins up to (h, s, v).
+    */
+    static void summedVolume(const std::vector<int>& histogram, std::vector<int64_t>& sums) {
+        const int sh = (S_BINS + 1) * (V_BINS + 1), sv = V_BINS + 1;
+        sums.assign((size_t)(H_BINS + 1) * sh, 0);
+        for (int h = 0; h < H_BINS; h++)
+            for (int s = 0; s < S_BINS; s++)
+                for (int v = 0; v < V_BINS; v++) {
+                    size_t i = (size_t)(h + 1) * sh + (s + 1) * sv + (v + 1);
+                    sums[i] = histogram[((size_t)h * S_BINS + s) * V_BINS + v]
+                            + sums[i - sh] + sums[i - sv] + sums[i - 1]
+                            - sums[i - sh - sv] - sums[i - sh - 1] - sums[i - sv - 1]
+                            + sums[i - sh - sv - 1];
+                }
+    }
+
+    /**
+        Returns: the number of pixels inside the box of bins [lo, hi] of each channel, from the summed volume.
+    */
+    static int64_t boxCount(const std::vector<int64_t>& sums, const int* lo, const int* hi) {
+        const int sh = (S_BINS + 1) * (V_BINS + 1), sv = V_BINS + 1;
+        size_t h0 = (size_t)lo[0] * sh, h1 = (size_t)(hi[0] + 1) * sh;
+        size_t s0 = (size_t)lo[1] * sv, s1 = (size_t)(hi[1] + 1) * sv;
+        size_t v0 = lo[2], v1 = hi[2] + 1;
+        return sums[h1 + s1 + v1] - sums[h0 + s1 + v1] - sums[h1 + s0 + v1] - sums[h1 + s1 + v0]
+             + sums[h0 + s0 + v1] + sums[h0 + s1 + v0] + sums[h1 + s0 + v0] - sums[h0 + s0 + v0];
+    }
+
+    /**
+        Returns: the fraction of the foreground inside a box minus the fraction of the background inside it.
+    */
+    double separation(const std::vector<int64_t>& fgSums, const std::vector<int64_t>& bgSums, const int* lo, const int* hi) const {
+        return boxCount(fgSums, lo, hi) / (double)foregroundCount - boxCount(bgSums, lo, hi) / (double)backgroundCount;
+    }
+
+    /**
+        Finds the bins of the 5% and 95% percentiles of a channel of a histogram.
+    */
+    static void percentiles(const std::vector<int>& histogram, int64_t count, int channel, int& lo, int& hi) {
+        const int bins[3] = {H_BINS, S_BINS, V_BINS};
+        std::vector<int64_t> marginal(bins[channel], 0);
+        for (int h = 0; h < H_BINS; h++)
+            for (int s = 0; s < S_BINS; s++)
+                for (int v = 0; v < V_BINS; v++) {
+                    int bin = channel == 0 ? h : (channel == 1 ? s : v);
+                    marginal[bin] += histogram[((size_t)h * S_BINS + s) * V_BINS + v];
+                }
+        lo = 0;
+        hi = bins[channel] - 1;
+        int64_t accumulated = 0;
+        for (int b = 0; b < bins[channel]; b++) {
+            if (accumulated <= count * 0.05)
+                lo = b;
+            accumulated += marginal[b];
+            if (accumulated >= count * 0.95) {
+                hi = b;
+                break;
+            }
+        }
+        hi = std::max(lo, hi);
+    }
+};
+
+#endif // HSV_CALIBRATION_H
@@ -0,0 +1,147 @@
+/**
+    Fused thresholding of BGR images into a binary mask, equivalent to cv::cvtColor(CV_BGR2HSV) followed by cv::inRange.
+    Instead of converting every pixel to HSV it looks up each BGR color in a precomputed table with one bit per color (2^24 bits, 2 MB),
+    which is built by running OpenCV's own conversion and threshold over every possible color, so the result is bit-exact with the OpenCV path.
+    A table is built once per HSV configuration, and the tables of the last configurations used are kept.
+*/
+
+#ifndef HSV_THRESHOLD_H
+#define HSV_THRESHOLD_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+class HsvThresholdTable {
+public:
+
+    /**
+        Builds the table for a HSV configuration.
+        Params:
+            hsvConfig - The HSV Configuration to apply the threshold: {minH, maxH, minS, maxS, minV, maxV}
+    */
+    explicit HsvThresholdTable(const int* hsvConfig) : bits((size_t)1 << 18) {
+        for (int i = 0; i < 6; i++)
+            config[i] = hsvConfig[i];
+
+        // Each blue value is an independent 256x256 image with every green (rows) and red (columns) value
+        cv::parallel_for_(cv::Range(0, 256), [&](const cv::Range& range) {
+            cv::Mat colors(256, 256, CV_8UC3), hsv, mask;
+            for (int b = range.start; b < range.end; b++) {
+                for (int g = 0; g < 256; g++) {
+                    uchar* p = colors.ptr<uchar>(g);
+                    for (int r = 0; r < 256; r++, p += 3) {
+                        p[0] = (uchar)b;
+                        p[1] = (uchar)g;
+                        p[2] = (uchar)r;
+                    }
+                }
+                cv::cvtColor(colors, hsv, CV_BGR2HSV);
+                cv::inRange(hsv, cv::Scalar(config[0], config[2], config[4]), cv::Scalar(config[1], config[3], config[5]), mask);
+
+                // The 65536 colors of this blue value fill 1024 words of the table, so the threads never share a word
+                uint64_t* words = &bits[(size_t)b << 10];
+                for (int g = 0; g < 256; g++) {
+                    const uchar* m = mask.ptr<uchar>(g);
+                    for (int r = 0; r < 256; r += 64) {
+                        uint64_t word = 0;
+                        for (int k = 0; k < 64; k++)
+                            word |= (uint64_t)(m[r + k] & 1) << k;
+                        words[(g << 2) | (r >> 6)] = word;
+                    }
+                }
+            }
+        });
+    }
+
+    /**
+        Returns: true if the table was built for the given HSV configuration.
+    */
+    bool matches(const int* hsvConfig) const {
+        for (int i = 0; i < 6; i++)
+            if (config[i] != hsvConfig[i])
+                return false;
+        return true;
+    }
+
+    /**
+        Thresholds a BGR image in one pass, in parallel by bands of rows.
+        Params:
+            img - The BGR image (8 bits, 3 channels)
+            mask - The output mask, with 255 for the pixels inside the HSV range and 0 for the rest
+    */
+    void apply(const cv::Mat& img, cv::Mat& mask) const {
+        CV_Assert(img.type() == CV_8UC3);
+        mask.create(img.rows, img.cols, CV_8U);
+        const uint64_t* table = &bits[0];
+        cv::parallel_for_(cv::Range(0, img.rows), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; y++) {
+                const uchar* p = img.ptr<uchar>(y);
+                uchar* out = mask.ptr<uchar>(y);
+                for (int x = 0; x < img.cols; x++, p += 3) {
+                    uint32_t color = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+                    out[x] = (uchar)(0 - (uchar)((table[color >> 6] >> (color & 63)) & 1));
+                }
+            }
+        });
+    }
+
+private:
+    int config[6];
+    std::vector<uint64_t> bits;
+};
+
+// Number of tables kept for the last HSV configurations used (2 MB each): the dataset threshold and hsv.config are used at the same time
+static const size_t MAX_HSV_TABLES = 4;
+
+/**
+    Function that gets the table of a HSV configuration, shared by all the threads. The tables of the last MAX_HSV_TABLES configurations
+    are kept, so callers alternating between configurations (streams of different sources) don't rebuild them. A table is built without
+    holding the lock, so the threads using the other configurations are not blocked meanwhile.
+    Params:
+        hsvConfig - The HSV Configuration: {minH, maxH, minS, maxS, minV, maxV}
+    Returns: the table of the configuration.
+*/
+inline std::shared_ptr<const HsvThresholdTable> hsvThresholdTable(const int* hsvConfig) {
+    static std::mutex tableMutex;
+    static std::list<std::shared_ptr<const HsvThresholdTable> > tables;   // Most recently used first
+
+    {
+        std::lock_guard<std::mutex> lock(tableMutex);
+        for (std::list<std::shared_ptr<const HsvThresholdTable> >::iterator it = tables.begin(); it != tables.end(); ++it) {
+            if ((*it)->matches(hsvConfig)) {
+                tables.splice(tables.begin(), tables, it);
+                return tables.front();
+            }
+        }
+    }
+
+    std::shared_ptr<const HsvThresholdTable> table = std::make_shared<HsvThresholdTable>(hsvConfig);
+    std::lock_guard<std::mutex> lock(tableMutex);
+    // Another thread may have built the same table meanwhile
+    for (std::list<std::shared_ptr<const HsvThresholdTable> >::iterator it = tables.begin(); it != tables.end(); ++it)
+        if ((*it)->matches(hsvConfig))
+            return *it;
+    tables.push_front(table);
+    if (tables.size() > MAX_HSV_TABLES)
+        tables.pop_back();
+    return table;
+}
+
+/**
+    Function that thresholds a BGR image with a HSV configuration, as cvtColor(CV_BGR2HSV) + inRange would do.
+    The table of the configuration is only built the first time it is used (see hsvThresholdTable).
+    Params:
+        img - The BGR image (8 bits, 3 channels)
+        mask - The output mask, with 255 for the pixels inside the HSV range and 0 for the rest
+        hsvConfig - The HSV Configuration to apply the threshold: {minH, maxH, minS, maxS, minV, maxV}
+*/
+inline void thresholdHsv(const cv::Mat& img, cv::Mat& mask, const int* hsvConfig) {
+    hsvThresholdTable(hsvConfig)->apply(img, mask);
+}
+
+#endif // HSV_THRESHOLD_H
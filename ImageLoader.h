@@ -0,0 +1,245 @@
+/**
+    Loading of the dataset images at the resolution the preprocessing works at. JPEG images wider than the working resolution are decoded
+    already reduced by 2, 4 or 8 (IMREAD_REDUCED_COLOR_*: the decoder scales the DCT of each block, so the discarded pixels are never computed)
+    instead of being decoded at full resolution and then resized by processImage.
+    The files are read ahead by a prefetcher thread while the workers decode the previous ones, and the buffers of the files and of the
+    decoded images are reused from one image to the next.
+*/
+
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+/**
+    Function that reads the size of a JPEG image from its frame header, without decoding it.
+    Params:
+        data - The bytes of the file
+        size - The number of bytes
+        imageSize - The size of the image
+    Returns: true if it is a JPEG image and its frame header was found, false otherwise.
+*/
+inline bool jpegImageSize(const uchar* data, size_t size, cv::Size& imageSize){
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF)
+            return false;
+        uchar marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        size_t length = ((size_t)data[pos + 2] << 8) | data[pos + 3];
+        // Start of frame markers (SOF0 to SOF15, except DHT, JPG and DAC) hold the height and the width
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 9 > size)
+                return false;
+            imageSize = cv::Size(((int)data[pos + 7] << 8) | data[pos + 8], ((int)data[pos + 5] << 8) | data[pos + 6]);
+            return imageSize.area() > 0;
+        }
+        if (marker == 0xDA || length < 2)
+            return false;
+        pos += 2 + length;
+    }
+    return false;
+}
+
+/**
+    Returns: the largest reduction of the JPEG decoder (1, 2, 4 or 8) that keeps an image at least as wide as the working resolution (1 if it is 0).
+*/
+inline int reducedDecodeFactor(cv::Size imageSize, int workWidth){
+    int factor = 1;
+    while (workWidth > 0 && factor < 8 && (imageSize.width + 2 * factor - 1) / (2 * factor) >= workWidth)
+        factor *= 2;
+    return factor;
+}
+
+/**
+    Function that decodes an image read in memory, reduced by the JPEG decoder if it is wider than the working resolution.
+    Params:
+        bytes - The bytes of the image file
+        workWidth - The working resolution of the preprocessing, 0 to decode the full resolution
+        img - The decoded image (BGR). Its buffer is reused if it has the size of the previous image
+        factor - If not NULL, the reduction the image was decoded with
+    Returns: true if the image could be decoded, false otherwise (img is empty).
+*/
+inline bool decodeImage(const std::vector<uchar>& bytes, int workWidth, cv::Mat& img, int* factor = NULL){
+    int reduction = 1;
+    cv::Size imageSize;
+    if (!bytes.empty() && jpegImageSize(&bytes[0], bytes.size(), imageSize))
+        reduction = reducedDecodeFactor(imageSize, workWidth);
+    if (factor != NULL)
+        *factor = reduction;
+    if (bytes.empty()) {
+        img.release();
+        return false;
+    }
+
+    int flags = reduction == 8 ? cv::IMREAD_REDUCED_COLOR_8 : (reduction == 4 ? cv::IMREAD_REDUCED_COLOR_4
+                                                              : (reduction == 2 ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_COLOR));
+    cv::imdecode(bytes, flags, &img);
+    return !img.empty();
+}
+
+/**
+    Function that reads a whole file into a buffer, reusing its memory.
+    Params:
+        path - The path of the file
+        bytes - The contents of the file
+    Returns: true if the file could be read, false otherwise (bytes is empty).
+*/
+inline bool readFileBytes(const std::string& path, std::vector<uchar>& bytes){
+    bytes.clear();
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    bool ok = fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? ftell(file) : -1;
+    ok = ok && size > 0 && fseek(file, 0, SEEK_SET) == 0;
+    if (ok) {
+        bytes.resize((size_t)size);
+        ok = fread(&bytes[0], 1, bytes.size(), file) == bytes.size();
+    }
+    fclose(file);
+    if (!ok)
+        bytes.clear();
+    return ok;
+}
+
+/**
+    Function that reads and decodes an image file at the working resolution, as the prefetched images of the dataset are decoded.
+    Params:
+        path - The path of the image
+        workWidth - The working resolution of the preprocessing, 0 to decode the full resolution
+        img - The decoded image (BGR), empty if it could not be read
+    Returns: true if the image could be read, false otherwise.
+*/
+inline bool readImage(const std::string& path, int workWidth, cv::Mat& img){
+    std::vector<uchar> bytes;
+    if (!readFileBytes(path, bytes)) {
+        img.release();
+        return false;
+    }
+    return decodeImage(bytes, workWidth, img);
+}
+
+class ImagePrefetcher {
+public:
+
+    /**
+        Starts reading the files in order in a background thread, keeping up to window files read ahead of the workers.
+        Params:
+            paths - The paths of the files, it must be valid while the prefetcher exists
+            window - The number of files that can wait in memory to be taken
+    */
+    ImagePrefetcher(const std::vector<std::string>& paths, int window) : paths(paths), window(std::max(1, window)),
+                                                                          stopping(false), finished(false), totalBytes(0) {
+        reader = std::thread(&ImagePrefetcher::readLoop, this);
+    }
+
+    ~ImagePrefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        spaceFree.notify_all();
+        reader.join();
+    }
+
+    /**
+        Takes the next file read, in the order of the paths. The buffer given is kept to read a later file, so the memory is reused.
+        Params:
+            index - The position of the file in the paths
+            bytes - The contents of the file, empty if it could not be read
+        Returns: true if a file was taken, false if every file was already taken.
+    */
+    bool next(int& index, std::vector<uchar>& bytes) {
+        std::unique_lock<std::mutex> lock(mutex);
+        fileReady.wait(lock, [this] { return !ready.empty() || finished; });
+        if (ready.empty())
+            return false;
+        if (bytes.capacity() > 0) {
+            buffers.push_back(std::vector<uchar>());
+            buffers.back().swap(bytes);
+        }
+        index = ready.front().index;
+        bytes.swap(ready.front().bytes);
+        ready.pop_front();
+        lock.unlock();
+        spaceFree.notify_one();
+        return true;
+    }
+
+    /**
+        Returns: the number of bytes read from the files.
+    */
+    long long bytesRead() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totalBytes;
+    }
+
+private:
+
+    struct ReadFile {
+        int index;
+        std::vector<uchar> bytes;
+    };
+
+    const std::vector<std::string>& paths;
+    size_t window;
+    bool stopping;
+    bool finished;                              // Every file was read
+    long long totalBytes;
+    std::deque<ReadFile> ready;                 // Files read and not taken yet, in order
+    std::vector<std::vector<uchar> > buffers;   // Buffers given back by the workers, to read the next files
+    mutable std::mutex mutex;
+    std::condition_variable fileReady;
+    std::condition_variable spaceFree;
+    std::thread reader;
+
+    /**
+        Loop of the reader thread: reads the files in order while there is room in the window.
+    */
+    void readLoop() {
+        for (size_t i = 0; i < paths.size(); i++) {
+            std::vector<uchar> bytes;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                spaceFree.wait(lock, [this] { return stopping || ready.size() < window; });
+                if (stopping)
+                    break;
+                if (!buffers.empty()) {
+                    bytes.swap(buffers.back());
+                    buffers.pop_back();
+                }
+            }
+            readFileBytes(paths[i], bytes);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                totalBytes += (long long)bytes.size();
+                ready.push_back(ReadFile());
+                ready.back().index = (int)i;
+                ready.back().bytes.swap(bytes);
+            }
+            fileReady.notify_one();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        fileReady.notify_all();
+    }
+};
+
+#endif // IMAGE_LOADER_H
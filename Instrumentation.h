@@ -0,0 +1,550 @@
+/**
+    Instrumentation of the hot paths of the program: wall time of each stage measured with a monotonic clock, latency histograms and event counters.
+    Every thread records into its own histograms (only that thread writes them, so recording takes no lock and no atomic read-modify-write),
+    and they are merged when the results are read. When a thread finishes, its histograms are merged into the ones of the finished threads
+    and freed, so programs that create short-lived threads don't keep their measures. When tracing is enabled, every measure is also kept as
+    an event for the Chrome trace viewer (chrome://tracing), in blocks allocated as they are needed up to a limit for the whole program.
+    The results can be printed or written as CSV, JSON or a Chrome trace file.
+*/
+
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+// Without winsock.h, which would clash with the winsock2.h of the prediction service
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+class Instrumentation {
+public:
+
+    // Maximum number of stages and counters that can be registered
+    static const int MAX_STAGES = 32;
+    static const int MAX_COUNTERS = 32;
+    // Buckets of the histograms: exact up to 4 ns, then 4 buckets for every power of 2 (a resolution of 25% or better)
+    static const int BUCKETS = 252;
+    // Maximum number of trace events kept by each thread, and by all the threads together (24 bytes each)
+    static const int TRACE_CAPACITY = 1 << 15;
+    static const int TRACE_TOTAL_CAPACITY = 1 << 18;
+    // Trace events of each block a thread allocates
+    static const int TRACE_BLOCK = 1 << 12;
+
+    /**
+        Summary of the measures of a stage over all the threads. The percentiles are estimated from the histograms.
+    */
+    struct StageSummary {
+        std::string name;
+        uint64_t count;
+        double totalMs, meanMs, minMs, p50Ms, p90Ms, p99Ms, maxMs;
+    };
+
+    /**
+        Returns: the current time in nanoseconds, from a monotonic clock (the origin is the first use of the instrumentation).
+    */
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch).count();
+    }
+
+    /**
+        Registers a stage, or finds it if it was already registered.
+        Params:
+            name - The name of the stage
+        Returns: the identifier of the stage, or -1 if there are already MAX_STAGES stages (its measures are ignored).
+    */
+    static int stage(const std::string& name) {
+        return registerName(registry().stageNames, name, MAX_STAGES);
+    }
+
+    /**
+        Registers a counter, or finds it if it was already registered.
+        Returns: the identifier of the counter, or -1 if there are already MAX_COUNTERS counters.
+    */
+    static int counter(const std::string& name) {
+        return registerName(registry().counterNames, name, MAX_COUNTERS);
+    }
+
+    /**
+        Enables or disables keeping the trace events. Threads that record for the first time while it is disabled don't keep events.
+    */
+    static void setTracing(bool enabled) {
+        registry().tracing = enabled;
+    }
+
+    /**
+        Records a measure of a stage in the histograms of the calling thread.
+        Params:
+            stage - The identifier of the stage
+            startNs - The time the stage started, as given by now()
+            endNs - The time the stage ended, as given by now()
+    */
+    static void record(int stage, int64_t startNs, int64_t endNs) {
+        if (stage < 0 || stage >= MAX_STAGES)
+            return;
+        ThreadStats& stats = threadStats();
+        uint64_t ns = endNs > startNs ? (uint64_t)(endNs - startNs) : 0;
+        increment(stats.buckets[stage][bucketOf(ns)], 1);
+        increment(stats.totalNs[stage], ns);
+        if (ns < stats.minNs[stage].load(std::memory_order_relaxed))
+            stats.minNs[stage].store(ns, std::memory_order_relaxed);
+        if (ns > stats.maxNs[stage].load(std::memory_order_relaxed))
+            stats.maxNs[stage].store(ns, std::memory_order_relaxed);
+
+        if (stats.tracing) {
+            int size = stats.traceSize.load(std::memory_order_relaxed);
+            TraceEvent* block = size < TRACE_CAPACITY ? stats.traceBlocks[size / TRACE_BLOCK].load(std::memory_order_relaxed) : 0;
+            if (!block && size < TRACE_CAPACITY && size % TRACE_BLOCK == 0)
+                block = allocateTraceBlock(stats, size / TRACE_BLOCK);
+            if (block) {
+                TraceEvent& event = block[size % TRACE_BLOCK];
+                event.stage = stage;
+                event.startNs = startNs;
+                event.durationNs = (int64_t)ns;
+                stats.traceSize.store(size + 1, std::memory_order_release);
+            }
+        }
+    }
+
+    /**
+        Adds a value to a counter.
+    */
+    static void add(int counter, long long value = 1) {
+        if (counter >= 0 && counter < MAX_COUNTERS)
+            registry().counters[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+        Returns: the current value of a counter.
+    */
+    static long long count(int counter) {
+        return counter >= 0 && counter < MAX_COUNTERS ? registry().counters[counter].load(std::memory_order_relaxed) : 0;
+    }
+
+    /**
+        Returns: the peak resident memory of the process (the peak working set on Windows) in bytes, 0 if it is not available.
+    */
+    static size_t peakResidentBytes() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS info;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info)))
+            return info.PeakWorkingSetSize;
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+#ifdef __APPLE__
+        return (size_t)usage.ru_maxrss;
+#else
+        return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+    }
+
+    /**
+        Returns: the summary of every stage with at least one measure, merging the histograms of all the threads.
+    */
+    static std::vector<StageSummary> summaries() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        std::vector<StageSummary> result;
+        for (size_t s = 0; s < reg.stageNames.size(); s++) {
+            std::vector<uint64_t> buckets(BUCKETS, 0);
+            uint64_t count = 0, totalNs = 0, minNs = std::numeric_limits<uint64_t>::max(), maxNs = 0;
+            for (size_t t = 0; t <= reg.threads.size(); t++) {
+                const ThreadStats& stats = t < reg.threads.size() ? *reg.threads[t] : reg.retired;
+                for (int b = 0; b < BUCKETS; b++) {
+                    uint64_t n = stats.buckets[s][b].load(std::memory_order_relaxed);
+                    buckets[b] += n;
+                    count += n;
+                }
+                totalNs += stats.totalNs[s].load(std::memory_order_relaxed);
+                minNs = std::min(minNs, (uint64_t)stats.minNs[s].load(std::memory_order_relaxed));
+                maxNs = std::max(maxNs, (uint64_t)stats.maxNs[s].load(std::memory_order_relaxed));
+            }
+            if (count == 0)
+                continue;
+
+            StageSummary summary;
+            summary.name = reg.stageNames[s];
+            summary.count = count;
+            summary.totalMs = totalNs / 1e6;
+            summary.meanMs = summary.totalMs / count;
+            summary.minMs = minNs / 1e6;
+            summary.maxMs = maxNs / 1e6;
+            summary.p50Ms = std::min(percentile(buckets, count, 0.50), maxNs) / 1e6;
+            summary.p90Ms = std::min(percentile(buckets, count, 0.90), maxNs) / 1e6;
+            summary.p99Ms = std::min(percentile(buckets, count, 0.99), maxNs) / 1e6;
+            result.push_back(summary);
+        }
+        return result;
+    }
+
+    /**
+        Prints the summary of every stage and the value of every counter.
+    */
+    static void print(std::ostream& out) {
+        std::ostringstream text;
+        std::vector<StageSummary> stages = summaries();
+        text << " Stage\tCount\tMean (ms)\tp50 (ms)\tp99 (ms)\tMax (ms)" << std::endl;
+        for (size_t s = 0; s < stages.size(); s++)
+            text << " " << stages[s].name << "\t" << stages[s].count << "\t" << stages[s].meanMs << "\t" << stages[s].p50Ms << "\t"
+                 << stages[s].p99Ms << "\t" << stages[s].maxMs << std::endl;
+        std::vector<std::string> counters = counterNames();
+        for (size_t c = 0; c < counters.size(); c++)
+            text << " " << counters[c] << ": " << count((int)c) << std::endl;
+        out << text.str();
+    }
+
+    /**
+        Writes the summary of the stages and the counters as CSV (one line per stage or counter).
+        Returns: true if the file could be written.
+    */
+    static bool writeCsv(const std::string& fileName) {
+        std::ofstream out(fileName.c_str());
+        if (!out.is_open())
+            return false;
+        out << "kind,name,count,total_ms,mean_ms,min_ms,p50_ms,p90_ms,p99_ms,max_ms\n";
+        std::vector<StageSummary> stages = summaries();
+        for (size_t s = 0; s < stages.size(); s++)
+            out << "stage," << stages[s].name << "," << stages[s].count << "," << stages[s].totalMs << "," << stages[s].meanMs << "," << stages[s].minMs << ","
+                << stages[s].p50Ms << "," << stages[s].p90Ms << "," << stages[s].p99Ms << "," << stages[s].maxMs << "\n";
+        std::vector<std::string> counters = counterNames();
+        for (size_t c = 0; c < counters.size(); c++)
+            out << "counter," << counters[c] << "," << count((int)c) << ",,,,,,,\n";
+        return true;
+    }
+
+    /**
+        Writes the summary of the stages and the counters as JSON.
+        Returns: true if the file could be written.
+    */
+    static bool writeJson(const std::string& fileName) {
+        std::ofstream out(fileName.c_str());
+        if (!out.is_open())
+            return false;
+        out << "{\n  \"stages\": [";
+        std::vector<StageSummary> stages = summaries();
+        for (size_t s = 0; s < stages.size(); s++)
+            out << (s > 0 ? "," : "") << "\n    {\"name\": \"" << escape(stages[s].name) << "\", \"count\": " << stages[s].count
+                << ", \"total_ms\": " << stages[s].totalMs << ", \"mean_ms\": " << stages[s].meanMs << ", \"min_ms\": " << stages[s].minMs
+                << ", \"p50_ms\": " << stages[s].p50Ms << ", \"p90_ms\": " << stages[s].p90Ms << ", \"p99_ms\": " << stages[s].p99Ms
+                << ", \"max_ms\": " << stages[s].maxMs << "}";
+        out << "\n  ],\n  \"counters\": {";
+        std::vector<std::string> counters = counterNames();
+        for (size_t c = 0; c < counters.size(); c++)
+            out << (c > 0 ? "," : "") << "\n    \"" << escape(counters[c]) << "\": " << count((int)c);
+        out << "\n  }\n}\n";
+        return true;
+    }
+
+    /**
+        Writes the trace events of all the threads in the Chrome trace event format (a complete event per measure, one track per thread).
+        Returns: true if the file could be written.
+    */
+    static bool writeChromeTrace(const std::string& fileName) {
+        std::ofstream out(fileName.c_str());
+        if (!out.is_open())
+            return false;
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        bool first = true;
+        for (size_t t = 0; t < reg.threads.size(); t++) {
+            const ThreadStats& stats = *reg.threads[t];
+            int tid = stats.threadId;
+            out << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+                << ", \"args\": {\"name\": \"Thread " << tid << "\"}}";
+            first = false;
+            int size = stats.traceSize.load(std::memory_order_acquire);
+            for (int e = 0; e < size; e++)
+                writeTraceEvent(out, reg, tid, stats.traceBlocks[e / TRACE_BLOCK].load(std::memory_order_relaxed)[e % TRACE_BLOCK]);
+        }
+        // Events of the threads that already finished, kept together by thread
+        for (size_t e = 0; e < reg.retiredTrace.size(); e++) {
+            int tid = reg.retiredTrace[e].threadId;
+            if (e == 0 || reg.retiredTrace[e - 1].threadId != tid) {
+                out << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+                    << ", \"args\": {\"name\": \"Thread " << tid << "\"}}";
+                first = false;
+            }
+            writeTraceEvent(out, reg, tid, reg.retiredTrace[e].event);
+        }
+        out << "\n]}\n";
+        return true;
+    }
+
+private:
+
+    struct TraceEvent {
+        int stage;
+        int64_t startNs;
+        int64_t durationNs;
+    };
+
+    struct RetiredEvent {
+        int threadId;
+        TraceEvent event;
+    };
+
+    // Measures of one thread. Only that thread writes them, the rest only read them
+    struct ThreadStats {
+        std::atomic<uint64_t> buckets[MAX_STAGES][BUCKETS];
+        std::atomic<uint64_t> totalNs[MAX_STAGES];
+        std::atomic<uint64_t> minNs[MAX_STAGES];
+        std::atomic<uint64_t> maxNs[MAX_STAGES];
+        int threadId;
+        bool tracing;                                                       // Keeps trace events, until the total limit is reached
+        std::atomic<TraceEvent*> traceBlocks[TRACE_CAPACITY / TRACE_BLOCK];  // Allocated when the previous one is full
+        std::atomic<int> traceSize;
+
+        ThreadStats(int threadId, bool tracing) : threadId(threadId), tracing(tracing), traceSize(0) {
+            for (int s = 0; s < MAX_STAGES; s++) {
+                for (int b = 0; b < BUCKETS; b++)
+                    buckets[s][b].store(0, std::memory_order_relaxed);
+                totalNs[s].store(0, std::memory_order_relaxed);
+                minNs[s].store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+                maxNs[s].store(0, std::memory_order_relaxed);
+            }
+            for (int b = 0; b < TRACE_CAPACITY / TRACE_BLOCK; b++)
+                traceBlocks[b].store(0, std::memory_order_relaxed);
+        }
+
+        ~ThreadStats() {
+            for (int b = 0; b < TRACE_CAPACITY / TRACE_BLOCK; b++)
+                delete[] traceBlocks[b].load(std::memory_order_relaxed);
+        }
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::chrono::steady_clock::time_point epoch;
+        std::vector<std::string> stageNames;
+        std::vector<std::string> counterNames;
+        std::vector<std::unique_ptr<ThreadStats> > threads;  // Threads that are running
+        ThreadStats retired;                                 // Measures of the threads that finished, merged
+        std::vector<RetiredEvent> retiredTrace;              // Trace events of the threads that finished
+        int nextThreadId;
+        std::atomic<int> traceEvents;                        // Trace events allocated or kept by all the threads
+        std::atomic<long long> counters[MAX_COUNTERS];
+        std::atomic<bool> tracing;
+
+        Registry() : epoch(std::chrono::steady_clock::now()), retired(-1, false), nextThreadId(0), traceEvents(0), tracing(false) {
+            for (int c = 0; c < MAX_COUNTERS; c++)
+                counters[c].store(0);
+        }
+    };
+
+    // Owner of the measures of a thread, that retires them when the thread finishes
+    struct ThreadHandle {
+        ThreadStats* stats;
+
+        ThreadHandle() : stats(0) {}
+
+        ~ThreadHandle() {
+            if (stats)
+                retire(stats);
+        }
+    };
+
+    static Registry& registry() {
+        static Registry reg;
+        return reg;
+    }
+
+    // Returns the measures of the calling thread, creating them the first time
+    static ThreadStats& threadStats() {
+        static thread_local ThreadHandle handle;
+        if (!handle.stats) {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            reg.threads.push_back(std::unique_ptr<ThreadStats>(new ThreadStats(reg.nextThreadId++, reg.tracing)));
+            handle.stats = reg.threads.back().get();
+        }
+        return *handle.stats;
+    }
+
+    // Merges the measures of a thread that finishes into the retired ones (keeping its trace events) and frees them
+    static void retire(ThreadStats* stats) {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (int s = 0; s < MAX_STAGES; s++) {
+            for (int b = 0; b < BUCKETS; b++)
+                increment(reg.retired.buckets[s][b], stats->buckets[s][b].load(std::memory_order_relaxed));
+            increment(reg.retired.totalNs[s], stats->totalNs[s].load(std::memory_order_relaxed));
+            reg.retired.minNs[s].store(std::min(reg.retired.minNs[s].load(std::memory_order_relaxed),
+                                                stats->minNs[s].load(std::memory_order_relaxed)), std::memory_order_relaxed);
+            reg.retired.maxNs[s].store(std::max(reg.retired.maxNs[s].load(std::memory_order_relaxed),
+                                                stats->maxNs[s].load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        }
+
+        int size = stats->traceSize.load(std::memory_order_relaxed);
+        int allocated = 0;
+        for (int b = 0; b < TRACE_CAPACITY / TRACE_BLOCK; b++)
+            if (stats->traceBlocks[b].load(std::memory_order_relaxed))
+                allocated += TRACE_BLOCK;
+        reg.retiredTrace.reserve(reg.retiredTrace.size() + size);
+        for (int e = 0; e < size; e++) {
+            RetiredEvent retiredEvent;
+            retiredEvent.threadId = stats->threadId;
+            retiredEvent.event = stats->traceBlocks[e / TRACE_BLOCK].load(std::memory_order_relaxed)[e % TRACE_BLOCK];
+            reg.retiredTrace.push_back(retiredEvent);
+        }
+        // The events kept still count towards the limit, the unused part of the blocks doesn't
+        reg.traceEvents.fetch_sub(allocated - size);
+
+        for (size_t t = 0; t < reg.threads.size(); t++) {
+            if (reg.threads[t].get() == stats) {
+                reg.threads.erase(reg.threads.begin() + t);
+                break;
+            }
+        }
+    }
+
+    // Allocates the next block of trace events of the calling thread, or stops its tracing if all the threads together reached the limit
+    static TraceEvent* allocateTraceBlock(ThreadStats& stats, int block) {
+        Registry& reg = registry();
+        if (reg.traceEvents.fetch_add(TRACE_BLOCK) + TRACE_BLOCK > TRACE_TOTAL_CAPACITY) {
+            reg.traceEvents.fetch_sub(TRACE_BLOCK);
+            stats.tracing = false;
+            return 0;
+        }
+        TraceEvent* events = new TraceEvent[TRACE_BLOCK];
+        stats.traceBlocks[block].store(events, std::memory_order_release);
+        return events;
+    }
+
+    static void writeTraceEvent(std::ostream& out, const Registry& reg, int threadId, const TraceEvent& event) {
+        out << ",\n{\"name\": \"" << escape(reg.stageNames[event.stage]) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << threadId
+            << ", \"ts\": " << event.startNs / 1e3 << ", \"dur\": " << event.durationNs / 1e3 << "}";
+    }
+
+    static int registerName(std::vector<std::string>& names, const std::string& name, int maxNames) {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        for (size_t i = 0; i < names.size(); i++)
+            if (names[i] == name)
+                return (int)i;
+        if ((int)names.size() >= maxNames)
+            return -1;
+        names.push_back(name);
+        return (int)names.size() - 1;
+    }
+
+    static std::vector<std::string> counterNames() {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        return registry().counterNames;
+    }
+
+    // Adds to a value only written by the calling thread (a plain load and store, it doesn't need a locked instruction)
+    static void increment(std::atomic<uint64_t>& value, uint64_t amount) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < 4)
+            return (int)ns;
+        int bit = 63;
+        while (!(ns >> bit))
+            bit--;
+        return (bit - 1) * 4 + (int)((ns >> (bit - 2)) & 3);
+    }
+
+    // Returns the lowest value of a bucket
+    static uint64_t bucketStart(int bucket) {
+        if (bucket < 4)
+            return (uint64_t)bucket;
+        int bit = bucket / 4 + 1;
+        return (uint64_t)(4 + bucket % 4) << (bit - 2);
+    }
+
+    // Estimates a percentile as the middle of the bucket it falls in
+    static uint64_t percentile(const std::vector<uint64_t>& buckets, uint64_t count, double p) {
+        uint64_t target = (uint64_t)(p * count + 0.5);
+        if (target < 1)
+            target = 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += buckets[b];
+            if (seen >= target) {
+                uint64_t start = bucketStart(b);
+                uint64_t end = b + 1 < BUCKETS ? bucketStart(b + 1) : start;
+                return start + (end - start) / 2;
+            }
+        }
+        return 0;
+    }
+
+    static std::string escape(const std::string& text) {
+        std::string result;
+        for (size_t i = 0; i < text.size(); i++) {
+            if (text[i] == '"' || text[i] == '\\')
+                result += '\\';
+            result += text[i];
+        }
+        return result;
+    }
+};
+
+/**
+    Timer that records the wall time of a stage from its creation until it is destroyed (or stopped).
+    Example:
+        {
+            ScopedTimer timer(STAGE_PROCESS);
+            processed = processImage(frame, hsvConfig);
+        }
+*/
+class ScopedTimer {
+public:
+    explicit ScopedTimer(int stage) : stageId(stage), startNs(Instrumentation::now()), endNs(-1) {}
+
+    ~ScopedTimer() {
+        stop();
+    }
+
+    /**
+        Stops the timer and records the measure, if it wasn't stopped already.
+    */
+    void stop() {
+        if (endNs < 0) {
+            endNs = Instrumentation::now();
+            Instrumentation::record(stageId, startNs, endNs);
+        }
+    }
+
+    /**
+        Returns: the seconds since the timer started, or until it was stopped.
+    */
+    double elapsedSeconds() const {
+        return ((endNs < 0 ? Instrumentation::now() : endNs) - startNs) / 1e9;
+    }
+
+private:
+    int stageId;
+    int64_t startNs;
+    int64_t endNs;
+
+    ScopedTimer(const ScopedTimer&);
+    ScopedTimer& operator=(const ScopedTimer&);
+};
+
+#endif // INSTRUMENTATION_H
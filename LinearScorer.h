@@ -0,0 +1,366 @@
+/**
+    Direct scorer for linear SVM models, used instead of converting every frame to float and calling SVM::predict.
+    When it is created, the one-vs-one decision functions of the model are collapsed into one weight vector each, interleaved by blocks of 16 features,
+    so a sample (the uint8 processed image or a float row) is read once and scored against all of them with SIMD dot products, without allocating memory.
+    The votes between the decision functions are counted the same way SVM::predict does.
+    The interleaved weights can also be used in place from a memory-mapped model bundle (see ModelBundle.h), without copying them.
+*/
+
+#ifndef LINEAR_SCORER_H
+#define LINEAR_SCORER_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/ml/ml.hpp>
+
+/**
+    Function that counts the votes of the one-vs-one decision functions as SVM::predict does: the function of classes i and j votes for i when its score is positive.
+    Params:
+        scores - The decision values of the functions, in the order the SVM stores them (0-1, 0-2, ..., 1-2, ...)
+        labels - The labels of the classes, sorted in ascending order
+    Returns: the label of the class with most votes (the first one in case of a tie).
+*/
+inline int voteOneVsOne(const double* scores, const std::vector<int>& labels) {
+    int classCount = (int)labels.size();
+    int votes[16] = {0};
+    for (int i = 0, p = 0; i < classCount; i++)
+        for (int j = i + 1; j < classCount; j++, p++)
+            votes[scores[p] > 0 ? i : j]++;
+
+    int best = 0;
+    for (int i = 1; i < classCount; i++)
+        if (votes[i] > votes[best])
+            best = i;
+    return labels[best];
+}
+
+class LinearSvmScorer {
+public:
+
+    // Number of features of each block of the interleaved weights
+    static const int BLOCK = 16;
+    // Maximum number of classes supported by the scorer (15 decision functions for the 6 classes of the gestures)
+    static const int MAX_CLASSES = 16;
+    static const int MAX_PAIRS = MAX_CLASSES * (MAX_CLASSES - 1) / 2;
+
+    LinearSvmScorer() : classCount(0), pairCount(0), varCount(0), blockCount(0), mappedWeights(NULL) {}
+
+    /**
+        Builds the weight vectors of a trained SVM.
+        Params:
+            svm - The trained model. It must be a C_SVC with a linear kernel
+            classLabels - The labels of the classes of the model, sorted in ascending order as the SVM stores them
+        Returns: true if the scorer could be built, false if the model is not supported (the caller should use SVM::predict).
+    */
+    bool create(const cv::Ptr<cv::ml::SVM>& svm, const std::vector<int>& classLabels) {
+        classCount = pairCount = varCount = blockCount = 0;
+        if (svm.empty() || !svm->isTrained() || svm->getType() != cv::ml::SVM::C_SVC || svm->getKernelType() != cv::ml::SVM::LINEAR)
+            return false;
+        int numClasses = (int)classLabels.size();
+        if (numClasses < 2 || numClasses > MAX_CLASSES)
+            return false;
+
+        cv::Mat sv = svm->getSupportVectors();
+        int numVars = sv.cols;
+        int numPairs = numClasses * (numClasses - 1) / 2;
+
+        // w = sum(alpha_k * sv_k) for each decision function (a linear model only keeps one compressed support vector per function)
+        std::vector<float> pairWeights((size_t)numPairs * numVars);
+        std::vector<double> pairRho(numPairs);
+        for (int p = 0; p < numPairs; p++) {
+            cv::Mat alpha, svidx;
+            pairRho[p] = svm->getDecisionFunction(p, alpha, svidx);
+            std::vector<double> w(numVars, 0.0);
+            for (int k = 0; k < (int)svidx.total(); k++) {
+                double a = alpha.depth() == CV_64F ? alpha.at<double>(k) : alpha.at<float>(k);
+                const float* v = sv.ptr<float>(svidx.at<int>(k));
+                for (int j = 0; j < numVars; j++)
+                    w[j] += a * v[j];
+            }
+            for (int j = 0; j < numVars; j++)
+                pairWeights[(size_t)p * numVars + j] = (float)w[j];
+        }
+
+        return create(pairWeights, pairRho, classLabels, numVars);
+    }
+
+    /**
+        Builds the scorer from the weight vectors of the decision functions, in the order the SVM stores them (0-1, 0-2, ..., 1-2, ...).
+        Params:
+            pairWeights - The weights of every decision function, one after the other
+            pairRho - The offset of every decision function (its score is w*x - rho)
+            classLabels - The labels of the classes, sorted in ascending order
+            numVars - Number of features of the samples
+        Returns: true if the scorer could be built.
+    */
+    bool create(const std::vector<float>& pairWeights, const std::vector<double>& pairRho, const std::vector<int>& classLabels, int numVars) {
+        int numClasses = (int)classLabels.size();
+        int numPairs = numClasses * (numClasses - 1) / 2;
+        if (numClasses < 2 || numClasses > MAX_CLASSES || (int)pairRho.size() != numPairs || pairWeights.size() != (size_t)numPairs * numVars)
+            return false;
+
+        classCount = numClasses;
+        pairCount = numPairs;
+        varCount = numVars;
+        blockCount = (numVars + BLOCK - 1) / BLOCK;
+        labels = classLabels;
+        rho = pairRho;
+        mappedWeights = NULL;
+        mapping.reset();
+
+        // Interleave the weights by blocks: [block][pair][16], padded with zeros
+        weights.assign((size_t)blockCount * pairCount * BLOCK, 0.f);
+        for (int p = 0; p < pairCount; p++)
+            for (int j = 0; j < varCount; j++)
+                weights[((size_t)(j / BLOCK) * pairCount + p) * BLOCK + j % BLOCK] = pairWeights[(size_t)p * varCount + j];
+        return true;
+    }
+
+    /**
+        Builds the scorer over weights already interleaved by blocks ([block][pair][16], padded with zeros), that are used in place.
+        Params:
+            interleavedWeights - The interleaved weights, aligned to 16 bytes
+            pairRho - The offset of every decision function
+            classLabels - The labels of the classes, sorted in ascending order
+            numVars - Number of features of the samples
+            owner - The owner of the memory of the weights (the mapped file), kept while the scorer (or any copy of it) uses them
+        Returns: true if the scorer could be built.
+    */
+    bool createInPlace(const float* interleavedWeights, const std::vector<double>& pairRho, const std::vector<int>& classLabels, int numVars,
+                       const std::shared_ptr<const void>& owner) {
+        classCount = pairCount = varCount = blockCount = 0;
+        int numClasses = (int)classLabels.size();
+        int numPairs = numClasses * (numClasses - 1) / 2;
+        if (numClasses < 2 || numClasses > MAX_CLASSES || (int)pairRho.size() != numPairs || numVars <= 0
+                || interleavedWeights == NULL || ((uintptr_t)interleavedWeights & 15) != 0)
+            return false;
+
+        classCount = numClasses;
+        pairCount = numPairs;
+        varCount = numVars;
+        blockCount = (numVars + BLOCK - 1) / BLOCK;
+        labels = classLabels;
+        rho = pairRho;
+        weights.clear();
+        mappedWeights = interleavedWeights;
+        mapping = owner;
+        return true;
+    }
+
+    bool empty() const { return pairCount == 0; }
+    int getPairCount() const { return pairCount; }
+    int getVarCount() const { return varCount; }
+    int getClassCount() const { return classCount; }
+    const std::vector<int>& getClassLabels() const { return labels; }
+
+    /**
+        Returns: the weights interleaved by blocks, [block][pair][16] with (varCount + 15) / 16 blocks.
+    */
+    const float* interleavedWeights() const {
+        return mappedWeights != NULL ? mappedWeights : &weights[0];
+    }
+
+    /**
+        Predicts the class of a sample of 8 bits features (the processed image, that must be continuous).
+        Returns: the label of the predicted class.
+    */
+    int predict(const uchar* sample) const {
+        double scores[MAX_PAIRS];
+        score(sample, scores);
+        return vote(scores);
+    }
+
+    /**
+        Predicts the class of a sample of float features (a row of the training or testing sets).
+        Returns: the label of the predicted class.
+    */
+    int predict(const float* sample) const {
+        double scores[MAX_PAIRS];
+        score(sample, scores);
+        return vote(scores);
+    }
+
+    /**
+        Predicts the class of a processed image or of a row of features.
+        Returns: the label of the predicted class.
+    */
+    int predict(const cv::Mat& sample) const {
+        CV_Assert(sample.isContinuous() && (int)sample.total() == varCount);
+        if (sample.depth() == CV_8U)
+            return predict(sample.ptr<uchar>());
+        CV_Assert(sample.depth() == CV_32F);
+        return predict(sample.ptr<float>());
+    }
+
+    /**
+        Predicts the classes of a batch of samples of 8 bits features (processed images, that must be continuous).
+        The weights are read once per batch: each block of them is applied to every sample while it is in the cache.
+        Params:
+            samples - The samples of the batch
+            count - The number of samples
+            predictions - The labels of the predicted classes
+    */
+    void predictBatch(const uchar* const* samples, int count, int* predictions) const {
+        std::vector<float> acc((size_t)count * pairCount * 4, 0.f);
+        int fullBlocks = varCount / BLOCK;
+        for (int b = 0; b < blockCount; b++) {
+            const float* w = interleavedWeights() + (size_t)b * pairCount * BLOCK;
+            for (int s = 0; s < count; s++) {
+                float (*sampleAcc)[4] = reinterpret_cast<float (*)[4]>(&acc[(size_t)s * pairCount * 4]);
+                if (b < fullBlocks) {
+                    const uchar* x = samples[s] + b * BLOCK;
+                    uint64_t lo, hi;
+                    memcpy(&lo, x, 8);
+                    memcpy(&hi, x + 8, 8);
+                    if ((lo | hi) != 0)
+                        accumulateBlock(x, w, sampleAcc);
+                } else {
+                    uchar tail[BLOCK] = {0};
+                    memcpy(tail, samples[s] + b * BLOCK, varCount - b * BLOCK);
+                    accumulateBlock(tail, w, sampleAcc);
+                }
+            }
+        }
+
+        double scores[MAX_PAIRS];
+        for (int s = 0; s < count; s++) {
+            const float* sampleAcc = &acc[(size_t)s * pairCount * 4];
+            for (int p = 0; p < pairCount; p++)
+                scores[p] = (double)sampleAcc[4 * p] + sampleAcc[4 * p + 1] + sampleAcc[4 * p + 2] + sampleAcc[4 * p + 3] - rho[p];
+            predictions[s] = vote(scores);
+        }
+    }
+
+    /**
+        Computes the decision values (w*x - rho) of all the decision functions for a sample of 8 bits features.
+        Blocks where every feature is 0 (most of the background of a mask) are skipped.
+    */
+    void score(const uchar* sample, double* scores) const {
+        float acc[MAX_PAIRS][4];
+        memset(acc, 0, sizeof(acc));
+
+        int fullBlocks = varCount / BLOCK;
+        for (int b = 0; b < fullBlocks; b++) {
+            const uchar* x = sample + b * BLOCK;
+            uint64_t lo, hi;
+            memcpy(&lo, x, 8);
+            memcpy(&hi, x + 8, 8);
+            if ((lo | hi) == 0)
+                continue;
+            accumulateBlock(x, interleavedWeights() + (size_t)b * pairCount * BLOCK, acc);
+        }
+        if (fullBlocks < blockCount) {
+            uchar tail[BLOCK] = {0};
+            memcpy(tail, sample + fullBlocks * BLOCK, varCount - fullBlocks * BLOCK);
+            accumulateBlock(tail, interleavedWeights() + (size_t)fullBlocks * pairCount * BLOCK, acc);
+        }
+
+        for (int p = 0; p < pairCount; p++)
+            scores[p] = (double)acc[p][0] + acc[p][1] + acc[p][2] + acc[p][3] - rho[p];
+    }
+
+    /**
+        Computes the decision values (w*x - rho) of all the decision functions for a sample of float features.
+    */
+    void score(const float* sample, double* scores) const {
+        float acc[MAX_PAIRS][4];
+        memset(acc, 0, sizeof(acc));
+
+        int fullBlocks = varCount / BLOCK;
+        for (int b = 0; b < fullBlocks; b++)
+            accumulateBlock(sample + b * BLOCK, interleavedWeights() + (size_t)b * pairCount * BLOCK, acc);
+        if (fullBlocks < blockCount) {
+            float tail[BLOCK] = {0};
+            memcpy(tail, sample + fullBlocks * BLOCK, (varCount - fullBlocks * BLOCK) * sizeof(float));
+            accumulateBlock(tail, interleavedWeights() + (size_t)fullBlocks * pairCount * BLOCK, acc);
+        }
+
+        for (int p = 0; p < pairCount; p++)
+            scores[p] = (double)acc[p][0] + acc[p][1] + acc[p][2] + acc[p][3] - rho[p];
+    }
+
+    /**
+        Returns: the label of the class with most votes of the decision functions.
+    */
+    int vote(const double* scores) const {
+        return voteOneVsOne(scores, labels);
+    }
+
+    /**
+        Returns: the weight of feature j in the decision function p.
+    */
+    float weight(int p, int j) const {
+        return interleavedWeights()[((size_t)(j / BLOCK) * pairCount + p) * BLOCK + j % BLOCK];
+    }
+
+    /**
+        Returns: the offset of the decision function p (its score is w*x - rho).
+    */
+    double getRho(int p) const {
+        return rho[p];
+    }
+
+private:
+
+    // Adds the products of a block of 16 features with the weights of every decision function
+    void accumulateBlock(const uchar* x, const float* w, float acc[][4]) const {
+#if CV_SIMD128
+        cv::v_uint16x8 x16a, x16b;
+        cv::v_expand(cv::v_load(x), x16a, x16b);
+        cv::v_uint32x4 x32[4];
+        cv::v_expand(x16a, x32[0], x32[1]);
+        cv::v_expand(x16b, x32[2], x32[3]);
+        cv::v_float32x4 xf[4];
+        for (int k = 0; k < 4; k++)
+            xf[k] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(x32[k]));
+        accumulateBlock(xf, w, acc);
+#else
+        float xf[BLOCK];
+        for (int k = 0; k < BLOCK; k++)
+            xf[k] = x[k];
+        accumulateBlock(xf, w, acc);
+#endif
+    }
+
+    void accumulateBlock(const float* x, const float* w, float acc[][4]) const {
+#if CV_SIMD128
+        cv::v_float32x4 xf[4];
+        for (int k = 0; k < 4; k++)
+            xf[k] = cv::v_load(x + 4 * k);
+        accumulateBlock(xf, w, acc);
+#else
+        for (int p = 0; p < pairCount; p++, w += BLOCK)
+            for (int k = 0; k < BLOCK; k++)
+                acc[p][k & 3] += x[k] * w[k];
+#endif
+    }
+
+#if CV_SIMD128
+    void accumulateBlock(const cv::v_float32x4* xf, const float* w, float acc[][4]) const {
+        for (int p = 0; p < pairCount; p++, w += BLOCK) {
+            cv::v_float32x4 sum = cv::v_load(acc[p]);
+            sum = cv::v_muladd(xf[0], cv::v_load(w), sum);
+            sum = cv::v_muladd(xf[1], cv::v_load(w + 4), sum);
+            sum = cv::v_muladd(xf[2], cv::v_load(w + 8), sum);
+            sum = cv::v_muladd(xf[3], cv::v_load(w + 12), sum);
+            cv::v_store(acc[p], sum);
+        }
+    }
+#endif
+
+    int classCount;
+    int pairCount;
+    int varCount;
+    int blockCount;
+    std::vector<int> labels;
+    std::vector<double> rho;
+    std::vector<float> weights;
+    const float* mappedWeights;             // Weights used in place, NULL if they are the ones of the vector
+    std::shared_ptr<const void> mapping;    // Owner of the weights used in place
+};
+
+#endif // LINEAR_SCORER_H
@@ -0,0 +1,279 @@
+/**
+    Multithreaded trainer of linear SVM models, used instead of the SMO solver of SVM::train (single threaded) for the linear kernel.
+    Each one-vs-one decision function is a binary problem solved with dual coordinate descent (the L1-loss solver of LIBLINEAR):
+    the weight vector is kept explicitly, so every step costs one dot product and one update of w instead of a row of the kernel matrix.
+    The binary problems are independent and run in parallel on the work-stealing pool, reading the same samples matrix (the rows of each
+    pair are only listed by index). The result is written as an OpenCV SVM with the linear kernel, like the ones SVM::train stores
+    (one compressed support vector per decision function), so it is stored, loaded and scored by the same code as the rest of the models.
+*/
+
+#ifndef LINEAR_TRAINER_H
+#define LINEAR_TRAINER_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/ml/ml.hpp>
+#include "CrossValidation.h"
+#include "ThreadPool.h"
+
+/**
+    Structure with the statistics of the training of a linear model.
+*/
+struct LinearTrainStats {
+    int pairs;                  // Number of one-vs-one decision functions
+    int maxIterations;          // Most passes over the samples that a decision function needed
+    int convergedPairs;         // Decision functions that reached the tolerance before the maximum number of passes
+    int threads;                // Number of threads that trained the decision functions
+    double seconds;             // Wall-clock time of the training
+};
+
+/**
+    Function that computes the dot product of the weights and a sample (8 bits or float features).
+*/
+template <typename T>
+inline double dotWeights(const std::vector<double>& w, const T* x){
+    double sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    int n = (int)w.size(), j = 0;
+    for (; j + 4 <= n; j += 4) {
+        sum0 += w[j] * x[j];
+        sum1 += w[j + 1] * x[j + 1];
+        sum2 += w[j + 2] * x[j + 2];
+        sum3 += w[j + 3] * x[j + 3];
+    }
+    for (; j < n; j++)
+        sum0 += w[j] * x[j];
+    return (sum0 + sum1) + (sum2 + sum3);
+}
+
+/**
+    Function that solves a binary linear SVM (C * hinge loss + ||w||^2 / 2) with dual coordinate descent and shrinking.
+    The bias is learned as the weight of a constant feature, so it is slightly regularized, unlike the bias of the SMO solver.
+    Params:
+        data - A matrix with the samples (one per row, of type T)
+        rows - The rows of the samples of the problem
+        y - The class of each of those rows, +1 or -1
+        C - The penalty of the errors
+        biasFeature - The value of the constant feature of the bias
+        eps - The tolerance of the projected gradient to stop
+        maxIterations - Maximum number of passes over the samples
+        w - The weights found
+        b - The bias found (the decision value is w*x + b)
+    Returns: the number of passes over the samples, maxIterations if it didn't converge.
+*/
+template <typename T>
+inline int trainLinearDcd(const cv::Mat& data, const std::vector<int>& rows, const std::vector<int>& y, double C, double biasFeature,
+                          double eps, int maxIterations, std::vector<double>& w, double& b){
+    int l = (int)rows.size();
+    w.assign(data.cols, 0.0);
+    double wb = 0;
+    std::vector<double> alpha(l, 0.0), QD(l);
+    std::vector<int> index(l);
+    for (int i = 0; i < l; i++) {
+        const T* x = data.ptr<T>(rows[i]);
+        double norm = biasFeature * biasFeature;
+        for (int j = 0; j < data.cols; j++)
+            norm += (double)x[j] * x[j];
+        QD[i] = norm;
+        index[i] = i;
+    }
+
+    cv::RNG rng(0x5eed);
+    double PGmaxOld = std::numeric_limits<double>::infinity();
+    double PGminOld = -std::numeric_limits<double>::infinity();
+    int active = l;
+    int iteration = 0;
+    while (iteration < maxIterations) {
+        double PGmaxNew = -std::numeric_limits<double>::infinity();
+        double PGminNew = std::numeric_limits<double>::infinity();
+
+        for (int s = 0; s < active; s++)
+            std::swap(index[s], index[s + rng.uniform(0, active - s)]);
+
+        for (int s = 0; s < active; s++) {
+            int i = index[s];
+            const T* x = data.ptr<T>(rows[i]);
+            double G = y[i] * (dotWeights(w, x) + wb * biasFeature) - 1;
+
+            // Projected gradient, and shrinking of the samples that are stuck at a bound
+            double PG = 0;
+            if (alpha[i] == 0) {
+                if (G > PGmaxOld) {
+                    std::swap(index[s--], index[--active]);
+                    continue;
+                }
+                if (G < 0)
+                    PG = G;
+            } else if (alpha[i] == C) {
+                if (G < PGminOld) {
+                    std::swap(index[s--], index[--active]);
+                    continue;
+                }
+                if (G > 0)
+                    PG = G;
+            } else {
+                PG = G;
+            }
+            PGmaxNew = std::max(PGmaxNew, PG);
+            PGminNew = std::min(PGminNew, PG);
+
+            if (std::fabs(PG) > 1e-12) {
+                double old = alpha[i];
+                alpha[i] = std::min(std::max(alpha[i] - G / QD[i], 0.0), C);
+                double d = (alpha[i] - old) * y[i];
+                for (int j = 0; j < data.cols; j++)
+                    w[j] += d * x[j];
+                wb += d * biasFeature;
+            }
+        }
+        iteration++;
+
+        if (PGmaxNew - PGminNew <= eps) {
+            if (active == l)
+                break;
+            // Check the shrunk samples before stopping
+            active = l;
+            PGmaxOld = std::numeric_limits<double>::infinity();
+            PGminOld = -std::numeric_limits<double>::infinity();
+            continue;
+        }
+        PGmaxOld = PGmaxNew > 0 ? PGmaxNew : std::numeric_limits<double>::infinity();
+        PGminOld = PGminNew < 0 ? PGminNew : -std::numeric_limits<double>::infinity();
+    }
+
+    b = wb * biasFeature;
+    return iteration;
+}
+
+/**
+    Function that builds an OpenCV SVM with the linear kernel from the weights of its one-vs-one decision functions.
+    The model is written as SVM::write does for a trained linear model (the weights of each function as its only support vector, with alpha 1)
+    and read back, so it behaves as if SVM::train had found it.
+    Params:
+        pairWeights - The weights of every decision function, in the order the SVM stores them (0-1, 0-2, ..., 1-2, ...)
+        pairRho - The offset of every decision function (its score is w*x - rho)
+        classLabels - The labels of the classes, sorted in ascending order
+        numVars - Number of features of the samples
+        params - The parameters the model was trained with
+    Returns: the SVM, empty if it could not be built.
+*/
+inline cv::Ptr<cv::ml::SVM> createLinearSvm(const std::vector<float>& pairWeights, const std::vector<double>& pairRho,
+                                            const std::vector<int>& classLabels, int numVars, const SvmParams& params){
+    int numPairs = (int)pairRho.size();
+    cv::FileStorage fs(".xml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+    fs << "opencv_ml_svm" << "{";
+    fs << "format" << 3;
+    fs << "svmType" << "C_SVC";
+    fs << "kernel" << "{" << "type" << "LINEAR" << "}";
+    fs << "C" << params.C;
+    fs << "term_criteria" << "{:" << "epsilon" << 1e-6 << "iterations" << (int)1e7 << "}";
+    fs << "var_count" << numVars;
+    fs << "class_count" << (int)classLabels.size();
+    fs << "class_labels" << cv::Mat(classLabels, true);
+    fs << "sv_total" << numPairs;
+    fs << "support_vectors" << "[";
+    for (int p = 0; p < numPairs; p++) {
+        fs << "[:";
+        fs.writeRaw("f", (const uchar*)&pairWeights[(size_t)p * numVars], numVars * sizeof(float));
+        fs << "]";
+    }
+    fs << "]";
+    fs << "decision_functions" << "[";
+    for (int p = 0; p < numPairs; p++) {
+        double alpha = 1;
+        fs << "{" << "sv_count" << 1 << "rho" << pairRho[p] << "alpha" << "[:";
+        fs.writeRaw("d", (const uchar*)&alpha, sizeof(alpha));
+        fs << "]" << "index" << "[:";
+        fs.writeRaw("i", (const uchar*)&p, sizeof(p));
+        fs << "]" << "}";
+    }
+    fs << "]" << "}";
+
+    cv::Ptr<cv::ml::SVM> svm = cv::Algorithm::loadFromString<cv::ml::SVM>(fs.releaseAndGetString());
+    if (svm.empty() || !svm->isTrained())
+        return cv::Ptr<cv::ml::SVM>();
+    return svm;
+}
+
+/**
+    Function that trains a linear SVM model (C_SVC) with dual coordinate descent, solving the one-vs-one decision functions in parallel.
+    Params:
+        data - A matrix with the samples (one per row, 8 bits or float). 8 bits samples are read as they are, without a float copy
+        classes - A matrix of one column with the classes of the samples
+        params - The parameters of the model, the kernel must be linear
+        stats - The statistics of the training
+        numThreads - Number of threads of the pool, one per core if it is 0
+        eps - The tolerance of the projected gradient to stop each decision function (0.1, as LIBLINEAR)
+        maxIterations - Maximum number of passes over the samples of each decision function
+    Returns: the trained SVM, empty if the model is not supported.
+*/
+inline cv::Ptr<cv::ml::SVM> trainLinearSvm(const cv::Mat& data, const cv::Mat& classes, const SvmParams& params, LinearTrainStats& stats,
+                                           int numThreads = 0, double eps = 0.1, int maxIterations = 1000){
+    int64 startTicks = cv::getTickCount();
+    stats.pairs = stats.maxIterations = stats.convergedPairs = stats.threads = 0;
+    stats.seconds = 0;
+    if (params.kernel != cv::ml::SVM::LINEAR || (data.type() != CV_32F && data.type() != CV_8U) || data.rows != (int)classes.total())
+        return cv::Ptr<cv::ml::SVM>();
+
+    // Classes sorted in ascending order, as the SVM stores them, and the rows of each one
+    std::vector<int> labels;
+    for (int i = 0; i < (int)classes.total(); i++)
+        labels.push_back(classes.at<int>(i));
+    std::sort(labels.begin(), labels.end());
+    labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+    int numClasses = (int)labels.size();
+    if (numClasses < 2)
+        return cv::Ptr<cv::ml::SVM>();
+    std::vector<std::vector<int> > classRows(numClasses);
+    for (int i = 0; i < (int)classes.total(); i++)
+        classRows[std::lower_bound(labels.begin(), labels.end(), classes.at<int>(i)) - labels.begin()].push_back(i);
+
+    // The constant feature of the bias takes the largest value of the features, so the bias is barely regularized
+    double minValue, maxValue;
+    cv::minMaxLoc(data, &minValue, &maxValue);
+    double biasFeature = std::max(1.0, std::max(std::fabs(minValue), std::fabs(maxValue)));
+
+    // One job per decision function: class i (+1) against class j (-1)
+    std::vector<std::pair<int,int> > pairs;
+    for (int i = 0; i < numClasses; i++)
+        for (int j = i + 1; j < numClasses; j++)
+            pairs.push_back(std::make_pair(i, j));
+    int numPairs = (int)pairs.size();
+    std::vector<float> pairWeights((size_t)numPairs * data.cols);
+    std::vector<double> pairRho(numPairs);
+    std::vector<int> iterations(numPairs);
+
+    WorkStealingPool pool(numThreads);
+    pool.parallelFor(0, numPairs, [&](int p) {
+        std::vector<int> rows(classRows[pairs[p].first]);
+        rows.insert(rows.end(), classRows[pairs[p].second].begin(), classRows[pairs[p].second].end());
+        std::vector<int> y(rows.size(), -1);
+        std::fill(y.begin(), y.begin() + classRows[pairs[p].first].size(), 1);
+
+        std::vector<double> w;
+        double b;
+        if (data.type() == CV_8U)
+            iterations[p] = trainLinearDcd<uchar>(data, rows, y, params.C, biasFeature, eps, maxIterations, w, b);
+        else
+            iterations[p] = trainLinearDcd<float>(data, rows, y, params.C, biasFeature, eps, maxIterations, w, b);
+        for (int j = 0; j < data.cols; j++)
+            pairWeights[(size_t)p * data.cols + j] = (float)w[j];
+        pairRho[p] = -b;
+    });
+
+    stats.pairs = numPairs;
+    stats.threads = pool.size();
+    for (int p = 0; p < numPairs; p++) {
+        stats.maxIterations = std::max(stats.maxIterations, iterations[p]);
+        if (iterations[p] < maxIterations)
+            stats.convergedPairs++;
+    }
+    cv::Ptr<cv::ml::SVM> svm = createLinearSvm(pairWeights, pairRho, labels, data.cols, params);
+    stats.seconds = (cv::getTickCount() - startTicks) / cv::getTickFrequency();
+    return svm;
+}
+
+#endif // LINEAR_TRAINER_H
@@ -0,0 +1,116 @@
+/**
+    Read-only memory mapping of a whole file, so its contents can be used in place without reading or parsing them.
+    It uses MapViewOfFile on Windows and mmap on the rest of the platforms.
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+// Without winsock.h, which would clash with the winsock2.h of the prediction service
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+public:
+
+    MappedFile() : mappedData(NULL), mappedSize(0) {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    /**
+        Maps a file in memory, closing the previous one if any.
+        Params:
+            path - The path of the file to map
+        Returns: true if the file could be mapped, false otherwise.
+    */
+    bool open(const std::string& path) {
+        close();
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (mapping == NULL)
+            return false;
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == NULL)
+            return false;
+
+        mappedData = (const unsigned char*)view;
+        mappedSize = (size_t)fileSize.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat fileInfo;
+        if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* view = mmap(NULL, (size_t)fileInfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED)
+            return false;
+
+        mappedData = (const unsigned char*)view;
+        mappedSize = (size_t)fileInfo.st_size;
+#endif
+        return true;
+    }
+
+    /**
+        Unmaps the file, if any.
+    */
+    void close() {
+        if (mappedData == NULL)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(mappedData);
+#else
+        munmap((void*)mappedData, mappedSize);
+#endif
+        mappedData = NULL;
+        mappedSize = 0;
+    }
+
+    bool isOpen() const { return mappedData != NULL; }
+    const unsigned char* data() const { return mappedData; }
+    size_t size() const { return mappedSize; }
+
+private:
+    // The mapping can't be copied, it would be unmapped twice
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char* mappedData;
+    size_t mappedSize;
+};
+
+#endif // MAPPED_FILE_H
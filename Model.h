@@ -0,0 +1,257 @@
+/**
+    Model of the Hand Gesture Classifier: the SVM together with the preprocessing parameters it was trained with (including its feature extractor)
+    and, optionally, the PCA projection of the features the SVM was trained over.
+    All of them are stored in the same file, the SVM as the first node (so StatModel::load<SVM> still reads it) and the rest after it.
+*/
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/ml/ml.hpp>
+#include "BitPacked.h"
+#include "FeatureExtractor.h"
+#include "LinearScorer.h"
+#include "Preprocessing.h"
+#include "Projection.h"
+
+struct HandModel {
+    cv::Ptr<cv::ml::SVM> svm;
+    PreprocessConfig preprocessing;
+    PcaProjection projection;       // Projection of the features given to the SVM, empty if the SVM takes the features themselves
+    std::vector<int> classLabels;   // Labels of the classes, in the order the SVM stores them
+    LinearSvmScorer scorer;         // Direct scorer of the features (with the projection folded in), empty if the kernel of the SVM is not linear
+    BitplaneScorer packedScorer;    // Scorer of bit-packed images, empty if the scorer is empty, the processed images are not binary or the features are not raw
+};
+
+/**
+    Returns: the feature extractor of a model, NULL if its name is unknown.
+*/
+inline const FeatureExtractor* modelFeatures(const HandModel& model){
+    return getFeatureExtractor(model.preprocessing.features);
+}
+
+/**
+    Function that builds the bit-packed scorer of a model from its linear scorer, if the processed images are binary and the features are raw.
+*/
+inline void createPackedScorer(HandModel& model){
+    model.packedScorer = BitplaneScorer();
+    const FeatureExtractor* extractor = modelFeatures(model);
+    if (!model.scorer.empty() && !model.preprocessing.isLegacy() && extractor != NULL && extractor->isRaw())
+        model.packedScorer.create(model.scorer);
+}
+
+/**
+    Function that builds the direct scorers of the SVM of a model, once its classes are known.
+    If the model has a projection, the weights of the linear SVM (over the components) are folded with it into weights over the features:
+    w * (E x - E mean) - rho = (E^T w) * x - (w * E mean + rho), so the scorers read the features and the projection costs nothing per frame.
+*/
+inline void createModelScorers(HandModel& model){
+    model.scorer.create(model.svm, model.classLabels);
+    if (!model.scorer.empty() && !model.projection.empty()) {
+        const PcaProjection& projection = model.projection;
+        LinearSvmScorer projected = model.scorer;
+        model.scorer = LinearSvmScorer();
+        if (projected.getVarCount() == projection.getComponentCount()) {
+            int numPairs = (int)model.classLabels.size() * ((int)model.classLabels.size() - 1) / 2;
+            int numVars = projection.getInputSize();
+            std::vector<float> pairWeights((size_t)numPairs * numVars, 0.f);
+            std::vector<double> pairRho(numPairs);
+            for (int p = 0; p < numPairs; p++) {
+                float* w = &pairWeights[(size_t)p * numVars];
+                pairRho[p] = projected.getRho(p);
+                for (int c = 0; c < projection.getComponentCount(); c++) {
+                    float wc = projected.weight(p, c);
+                    const float* e = projection.component(c);
+                    for (int j = 0; j < numVars; j++)
+                        w[j] += wc * e[j];
+                    pairRho[p] += (double)wc * projection.offset(c);
+                }
+            }
+            model.scorer.create(pairWeights, pairRho, model.classLabels, numVars);
+        }
+    }
+    createPackedScorer(model);
+}
+
+/**
+    Function that sets the classes of a model from the classes of its training set and builds the direct scorer of its SVM.
+    Params:
+        model - The model, with its SVM already trained
+        trainClasses - The classes of the training set
+*/
+inline void setModelClasses(HandModel& model, const cv::Mat& trainClasses){
+    model.classLabels.clear();
+    for (int k = 0; k < (int)trainClasses.total(); k++)
+        model.classLabels.push_back(trainClasses.at<int>(k));
+    std::sort(model.classLabels.begin(), model.classLabels.end());
+    model.classLabels.erase(std::unique(model.classLabels.begin(), model.classLabels.end()), model.classLabels.end());
+    createModelScorers(model);
+}
+
+/**
+    Function that stores a model in a file.
+    Params:
+        model - The model to store
+        fileName - The path of the file
+    Returns: true if the file could be written, false otherwise.
+*/
+inline bool saveModel(const HandModel& model, const std::string& fileName){
+    cv::FileStorage fs(fileName, cv::FileStorage::WRITE);
+    if (!fs.isOpened())
+        return false;
+
+    fs << model.svm->getDefaultName() << "{";
+    model.svm->write(fs);
+    fs << "}";
+
+    fs << "preprocessing";
+    model.preprocessing.write(fs);
+
+    if (!model.projection.empty()) {
+        fs << "projection";
+        model.projection.write(fs);
+    }
+    return true;
+}
+
+/**
+    Function that loads a model from a file. The file is parsed only once for the SVM and its preprocessing.
+    Files stored before the preprocessing was configurable get the legacy preprocessing.
+    Params:
+        fileName - The path of the file
+        model - The loaded model
+    Returns: true if the model could be loaded, false otherwise.
+*/
+inline bool loadModel(const std::string& fileName, HandModel& model){
+    cv::FileStorage fs(fileName, cv::FileStorage::READ);
+    if (!fs.isOpened())
+        return false;
+
+    cv::FileNode svmNode = fs.getFirstTopLevelNode();
+    model.svm = cv::ml::SVM::create();
+    model.svm->read(svmNode);
+    if (!model.svm->isTrained())
+        return false;
+
+    // The SVM doesn't give access to its classes, they are read from its node
+    cv::Mat labels;
+    cv::read(svmNode["class_labels"], labels);
+    model.classLabels.clear();
+    for (int k = 0; k < (int)labels.total(); k++)
+        model.classLabels.push_back(labels.at<int>(k));
+
+    if (!model.preprocessing.read(fs["preprocessing"]))
+        model.preprocessing = PreprocessConfig::legacy();
+    if (modelFeatures(model) == NULL)
+        return false;
+    // Models without a projection don't have its node
+    model.projection = PcaProjection();
+    model.projection.read(fs["projection"]);
+    createModelScorers(model);
+    return true;
+}
+
+/**
+    Function that computes the features of a processed image with the extractor of a model.
+    Params:
+        model - The model
+        processed - The processed image, as given by processImage
+        features - The features, as a row of floats
+*/
+inline void computeFeatures(const HandModel& model, const cv::Mat& processed, cv::Mat& features){
+    const FeatureExtractor* extractor = modelFeatures(model);
+    CV_Assert(extractor != NULL);
+    features.create(1, extractor->size(processed.size()), CV_32F);
+    extractor->compute(processed, features.ptr<float>());
+}
+
+/**
+    Function that predicts rows of features with SVM::predict, projecting them first if the model has a projection.
+    Params:
+        model - The model
+        rows - The features, one sample per row (8 bits or float)
+        responses - The predicted classes, one per row (float)
+*/
+inline void predictFeatureRows(const HandModel& model, const cv::Mat& rows, cv::Mat& responses){
+    cv::Mat input;
+    if (!model.projection.empty())
+        model.projection.projectRows(rows, input);
+    else if (rows.type() != CV_32F)
+        rows.convertTo(input, CV_32F);
+    else
+        input = rows;
+    model.svm->predict(input, responses);
+}
+
+/**
+    Function that predicts the class of a processed image.
+    Linear models with raw features score the 8 bits image directly. Other features are computed first, and models that are not linear use SVM::predict.
+    An image that doesn't have the size the model was trained with fails the checks of the scorer (or of the SVM) instead of being read out of bounds.
+    Params:
+        model - The model
+        processed - The processed image, as given by processImage
+    Returns: the predicted class.
+*/
+inline float predictProcessed(const HandModel& model, const cv::Mat& processed){
+    const FeatureExtractor* extractor = modelFeatures(model);
+    bool raw = extractor == NULL || extractor->isRaw();
+    if (raw && !model.scorer.empty() && processed.isContinuous() && processed.depth() == CV_8U && (int)processed.total() == model.scorer.getVarCount())
+        return (float)model.scorer.predict(processed.ptr<uchar>());
+
+    cv::Mat features;
+    if (raw && processed.isContinuous() && processed.depth() == CV_8U)
+        features = processed.reshape(1, 1);
+    else
+        computeFeatures(model, processed, features);
+    if (!model.scorer.empty())
+        return (float)model.scorer.predict(features);
+    cv::Mat responses;
+    predictFeatureRows(model, features, responses);
+    return responses.at<float>(0);
+}
+
+/**
+    Function that predicts the classes of a batch of processed images with a single scoring call.
+    Linear models with raw features score the 8 bits images directly, the rest compute the features of each image into the rows of a float matrix.
+    Params:
+        model - The model
+        processed - The processed images, as given by processImage
+        predictions - The predicted classes
+*/
+inline void predictProcessedBatch(const HandModel& model, const std::vector<cv::Mat>& processed, std::vector<int>& predictions){
+    predictions.assign(processed.size(), 0);
+    if (processed.empty())
+        return;
+
+    const FeatureExtractor* extractor = modelFeatures(model);
+    bool direct = !model.scorer.empty() && (extractor == NULL || extractor->isRaw());
+    for (size_t i = 0; i < processed.size() && direct; i++)
+        direct = processed[i].isContinuous() && processed[i].depth() == CV_8U && (int)processed[i].total() == model.scorer.getVarCount();
+    if (direct) {
+        std::vector<const uchar*> samples(processed.size());
+        for (size_t i = 0; i < processed.size(); i++)
+            samples[i] = processed[i].ptr<uchar>();
+        model.scorer.predictBatch(&samples[0], (int)samples.size(), &predictions[0]);
+        return;
+    }
+
+    CV_Assert(extractor != NULL);
+    cv::Mat data((int)processed.size(), extractor->size(processed[0].size()), CV_32F);
+    for (size_t i = 0; i < processed.size(); i++)
+        extractor->compute(processed[i], data.ptr<float>((int)i));
+    if (!model.scorer.empty()) {
+        for (size_t i = 0; i < processed.size(); i++)
+            predictions[i] = model.scorer.predict(data.ptr<float>((int)i));
+        return;
+    }
+    cv::Mat responses;
+    predictFeatureRows(model, data, responses);
+    for (size_t i = 0; i < processed.size(); i++)
+        predictions[i] = (int)responses.at<float>((int)i);
+}
+
+#endif // MODEL_H
@@ -0,0 +1,144 @@
+/**
+    Binary bundle of a linear model, loaded by memory-mapping it instead of parsing the XML/YAML file of the SVM.
+    It holds the preprocessing of the model, its classes and the weights of its decision functions already interleaved by blocks as the
+    linear scorer reads them (with the PCA projection folded in, if any), aligned to 64 bytes so the scorer uses them in place.
+    Only linear models can be bundled: the rest keep being loaded from the file written by saveModel.
+*/
+
+#ifndef MODEL_BUNDLE_H
+#define MODEL_BUNDLE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "LinearScorer.h"
+#include "MappedFile.h"
+#include "Model.h"
+
+// Header of the bundle file, followed by the offsets of the decision functions (double) and the interleaved weights (float, aligned to 64 bytes)
+struct ModelBundleHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t workWidth;
+    int32_t featureWidth;
+    int32_t featureHeight;
+    int32_t cropHand;
+    char features[32];              // Name of the feature extractor, ended by '\0'
+    int32_t numClasses;
+    int32_t numVars;
+    int32_t classLabels[LinearSvmScorer::MAX_CLASSES];
+    uint64_t rhoOffset;
+    uint64_t weightsOffset;
+    uint64_t fileSize;
+};
+
+static const char MODEL_BUNDLE_MAGIC[8] = {'H', 'N', 'C', 'M', 'O', 'D', 'E', 'L'};
+static const uint32_t MODEL_BUNDLE_VERSION = 1;
+
+/**
+    Function that stores the linear scorer of a model in a bundle. It is written in a temporary file and then renamed, so a failed write never leaves a broken bundle.
+    Params:
+        model - The model to store, it must have a linear scorer
+        fileName - The path of the bundle
+    Returns: true if the bundle was written, false if the model is not linear or the file could not be written.
+*/
+inline bool saveModelBundle(const HandModel& model, const std::string& fileName){
+    const LinearSvmScorer& scorer = model.scorer;
+    if (scorer.empty() || model.preprocessing.features.size() >= sizeof(ModelBundleHeader().features))
+        return false;
+
+    int numPairs = scorer.getPairCount();
+    int numBlocks = (scorer.getVarCount() + LinearSvmScorer::BLOCK - 1) / LinearSvmScorer::BLOCK;
+    size_t weightsBytes = (size_t)numBlocks * numPairs * LinearSvmScorer::BLOCK * sizeof(float);
+
+    ModelBundleHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MODEL_BUNDLE_MAGIC, sizeof(h.magic));
+    h.version = MODEL_BUNDLE_VERSION;
+    h.workWidth = model.preprocessing.workWidth;
+    h.featureWidth = model.preprocessing.featureSize.width;
+    h.featureHeight = model.preprocessing.featureSize.height;
+    h.cropHand = model.preprocessing.cropHand ? 1 : 0;
+    memcpy(h.features, model.preprocessing.features.c_str(), model.preprocessing.features.size());
+    h.numClasses = scorer.getClassCount();
+    h.numVars = scorer.getVarCount();
+    for (int c = 0; c < h.numClasses; c++)
+        h.classLabels[c] = scorer.getClassLabels()[c];
+    h.rhoOffset = sizeof(ModelBundleHeader);
+    h.weightsOffset = (h.rhoOffset + numPairs * sizeof(double) + 63) / 64 * 64;
+    h.fileSize = h.weightsOffset + weightsBytes;
+
+    std::vector<double> rho(numPairs);
+    for (int p = 0; p < numPairs; p++)
+        rho[p] = scorer.getRho(p);
+
+    std::string tmpPath = fileName + ".tmp";
+    std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+        return false;
+    out.write((const char*)&h, sizeof(h));
+    out.write((const char*)&rho[0], rho.size() * sizeof(double));
+    std::string padding((size_t)(h.weightsOffset - h.rhoOffset - rho.size() * sizeof(double)), '\0');
+    out.write(padding.data(), padding.size());
+    out.write((const char*)scorer.interleavedWeights(), weightsBytes);
+    out.close();
+    if (!out) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    remove(fileName.c_str());
+    return rename(tmpPath.c_str(), fileName.c_str()) == 0;
+}
+
+/**
+    Function that loads a model from a bundle. The file is mapped and its weights are used in place by the linear scorer; nothing is parsed.
+    The model has no SVM (model.svm is empty): it predicts with its scorers.
+    Params:
+        fileName - The path of the bundle
+        model - The loaded model
+    Returns: true if the bundle could be loaded, false if it doesn't exist or is not valid.
+*/
+inline bool loadModelBundle(const std::string& fileName, HandModel& model){
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(fileName) || file->size() < sizeof(ModelBundleHeader))
+        return false;
+
+    // Check the header and the layout of the file
+    const ModelBundleHeader* h = (const ModelBundleHeader*)file->data();
+    if (memcmp(h->magic, MODEL_BUNDLE_MAGIC, sizeof(h->magic)) != 0 || h->version != MODEL_BUNDLE_VERSION)
+        return false;
+    if (h->numClasses < 2 || h->numClasses > LinearSvmScorer::MAX_CLASSES || h->numVars <= 0 || memchr(h->features, '\0', sizeof(h->features)) == NULL)
+        return false;
+    int numPairs = h->numClasses * (h->numClasses - 1) / 2;
+    int numBlocks = (h->numVars + LinearSvmScorer::BLOCK - 1) / LinearSvmScorer::BLOCK;
+    size_t weightsBytes = (size_t)numBlocks * numPairs * LinearSvmScorer::BLOCK * sizeof(float);
+    if (h->fileSize != file->size() || h->rhoOffset + numPairs * sizeof(double) > h->weightsOffset
+            || h->weightsOffset % 64 != 0 || h->weightsOffset + weightsBytes > file->size())
+        return false;
+
+    HandModel loaded;
+    loaded.preprocessing.workWidth = h->workWidth;
+    loaded.preprocessing.featureSize = cv::Size(h->featureWidth, h->featureHeight);
+    loaded.preprocessing.cropHand = h->cropHand != 0;
+    loaded.preprocessing.features = h->features;
+    const FeatureExtractor* extractor = modelFeatures(loaded);
+    if (extractor == NULL || extractor->size(loaded.preprocessing.featureSize) != h->numVars)
+        return false;
+
+    loaded.classLabels.assign(h->classLabels, h->classLabels + h->numClasses);
+    std::vector<double> rho(numPairs);
+    memcpy(&rho[0], file->data() + h->rhoOffset, numPairs * sizeof(double));
+    const float* weights = (const float*)(file->data() + h->weightsOffset);
+    if (!loaded.scorer.createInPlace(weights, rho, loaded.classLabels, h->numVars, file))
+        return false;
+    createPackedScorer(loaded);
+
+    model = loaded;
+    return true;
+}
+
+#endif // MODEL_BUNDLE_H
@@ -0,0 +1,481 @@
+/**
+    Prediction service: the model is loaded once and the frames are received from other processes over a Unix domain socket.
+    Every client connection has its own thread that decodes and processes its frames; the processed frames of all the clients are queued
+    and a single thread predicts them in batches (up to maxBatch frames, waiting at most maxWaitMs for the batch to fill) with one scoring call.
+
+    Protocol (integers in the byte order of the machine): each request is a RequestHeader followed by payloadSize bytes, and is answered
+    with a ResponseHeader followed by payloadSize bytes.
+        REQUEST_ENCODED - The payload is an encoded image (jpg, png...). Answered with the predicted label and the timing
+        REQUEST_RAW_BGR - The payload is a BGR image of width x height pixels. Answered as REQUEST_ENCODED
+        REQUEST_STATS - Answered with the statistics of the service as JSON in the payload
+        REQUEST_SHUTDOWN - Stops the service
+    On Windows the Unix domain sockets of Winsock are used (Windows 10 version 1803 or later).
+*/
+
+#ifndef PREDICTION_SERVER_H
+#define PREDICTION_SERVER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include "Instrumentation.h"
+#include "Model.h"
+#include "Preprocessing.h"
+
+// Sockets of the platform: Winsock handles on Windows, file descriptors elsewhere
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+const int SHUTDOWN_BOTH = SD_BOTH;
+const int SEND_FLAGS = 0;
+inline void closeSocket(SocketHandle handle) { closesocket(handle); }
+#else
+typedef int SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = -1;
+const int SHUTDOWN_BOTH = SHUT_RDWR;
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+inline void closeSocket(SocketHandle handle) { close(handle); }
+#endif
+
+// Default path of the socket of the service
+#ifdef _WIN32
+const char* const DEFAULT_SOCKET_PATH = "HandNumbersClassifier.sock";
+#else
+const char* const DEFAULT_SOCKET_PATH = "/tmp/HandNumbersClassifier.sock";
+#endif
+
+const uint32_t REQUEST_MAGIC = 0x52434e48;   // "HNCR"
+const uint32_t RESPONSE_MAGIC = 0x41434e48;  // "HNCA"
+
+enum RequestType {
+    REQUEST_ENCODED = 0,
+    REQUEST_RAW_BGR = 1,
+    REQUEST_STATS = 2,
+    REQUEST_SHUTDOWN = 3
+};
+
+struct RequestHeader {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t width;         // Only for REQUEST_RAW_BGR
+    uint32_t height;        // Only for REQUEST_RAW_BGR
+    uint32_t payloadSize;
+};
+
+struct ResponseHeader {
+    uint32_t magic;
+    int32_t status;         // 0 if the request was served, negative otherwise
+    int32_t label;          // Predicted class
+    uint32_t batchSize;     // Number of frames predicted in the same batch
+    float decodeMs;         // Time decoding and processing the frame
+    float queueMs;          // Time waiting for the batch
+    float predictMs;        // Time predicting the batch
+    float totalMs;          // Time since the request was received until it was answered
+    uint32_t payloadSize;
+};
+
+class PredictionServer {
+public:
+
+    // Maximum size of the payload of a request
+    static const uint32_t MAX_PAYLOAD = 64 << 20;
+
+    /**
+        Creates the service.
+        Params:
+            model - The model used for the predictions
+            hsvConfig - The HSV configuration used to process the frames
+            maxBatch - Maximum number of frames predicted together
+            maxWaitMs - Maximum time the first frame of a batch waits for more frames
+    */
+    PredictionServer(const HandModel& model, const int* hsvConfig, int maxBatch = 16, double maxWaitMs = 2)
+        : model(model), maxBatch(std::max(1, maxBatch)), maxWaitMs(std::max(0.0, maxWaitMs)), listenFd(INVALID_SOCKET_HANDLE), listenClosed(false), stopping(false), reaping(false),
+          requests(0), batches(0), errors(0), maxQueueDepth(0), startNs(0),
+          predictStage(Instrumentation::stage("service: predict batch")), requestStage(Instrumentation::stage("service: request")) {
+        std::copy(hsvConfig, hsvConfig + 6, this->hsvConfig);
+    }
+
+    /**
+        Runs the service until a REQUEST_SHUTDOWN is received.
+        Params:
+            socketPath - The path of the socket (it is replaced if it exists)
+        Returns: false if the socket could not be created.
+    */
+    bool run(const std::string& socketPath) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+            return false;
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+#ifdef _WIN32
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+            return false;
+#endif
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd == INVALID_SOCKET_HANDLE) {
+            cleanupSockets();
+            return false;
+        }
+        remove(socketPath.c_str());
+        if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+            closeSocket(listenFd);
+            cleanupSockets();
+            return false;
+        }
+
+#ifndef _WIN32
+        // Writing to a client that closed its connection must not kill the service (where send has no MSG_NOSIGNAL)
+        signal(SIGPIPE, SIG_IGN);
+#endif
+
+        startNs = Instrumentation::now();
+        std::thread batchThread(&PredictionServer::batchLoop, this);
+        reaping = true;
+        std::thread reaperThread(&PredictionServer::reapLoop, this);
+        while (!stopping) {
+            SocketHandle clientFd = accept(listenFd, NULL, NULL);
+            if (clientFd == INVALID_SOCKET_HANDLE) {
+#ifndef _WIN32
+                if (errno == EINTR)
+                    continue;
+#endif
+                break;
+            }
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clientFds.push_back(clientFd);
+            clientThreads.push_back(std::thread(&PredictionServer::clientLoop, this, clientFd));
+        }
+
+        // Stop the clients and the batches
+        stop();
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            for (size_t i = 0; i < clientFds.size(); i++)
+                shutdown(clientFds[i], SHUTDOWN_BOTH);
+            reaping = false;
+        }
+        clientFinished.notify_all();
+        reaperThread.join();
+        std::vector<std::thread> remaining;
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            remaining.swap(clientThreads);
+        }
+        for (size_t i = 0; i < remaining.size(); i++)
+            remaining[i].join();
+        batchThread.join();
+#ifndef _WIN32
+        closeSocket(listenFd);
+#endif
+        remove(socketPath.c_str());
+        cleanupSockets();
+        return true;
+    }
+
+    /**
+        Returns: the statistics of the service as JSON: requests served, batches, mean batch size, throughput and queue depth.
+    */
+    std::string stats() {
+        double seconds = (Instrumentation::now() - startNs) / 1e9;
+        size_t depth;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            depth = queue.size();
+        }
+        long long served = requests, batchCount = batches;
+        std::ostringstream json;
+        json << "{\"requests\": " << served << ", \"errors\": " << (long long)errors << ", \"batches\": " << batchCount
+             << ", \"mean_batch_size\": " << (batchCount > 0 ? (double)served / batchCount : 0)
+             << ", \"requests_per_second\": " << (seconds > 0 ? served / seconds : 0)
+             << ", \"queue_depth\": " << depth << ", \"max_queue_depth\": " << (long long)maxQueueDepth
+             << ", \"max_batch\": " << maxBatch << ", \"max_wait_ms\": " << maxWaitMs << "}";
+        return json.str();
+    }
+
+private:
+
+    // A processed frame waiting to be predicted
+    struct PendingFrame {
+        cv::Mat processed;
+        int64_t receivedNs;
+        int64_t queuedNs;
+        int label;
+        int batchSize;
+        int64_t predictStartNs;
+        int64_t predictEndNs;
+        std::promise<void> done;
+    };
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        // Wake up the accept of run: Winsock only does it when the socket is closed
+        if (listenFd != INVALID_SOCKET_HANDLE && !listenClosed.exchange(true)) {
+#ifdef _WIN32
+            closeSocket(listenFd);
+#else
+            shutdown(listenFd, SHUTDOWN_BOTH);
+#endif
+        }
+    }
+
+    static void cleanupSockets() {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    // Joins the threads of the clients as soon as they leave, so a long running service doesn't keep them
+    void reapLoop() {
+        std::unique_lock<std::mutex> lock(clientsMutex);
+        while (true) {
+            clientFinished.wait(lock, [&]() { return !reaping || !finishedClients.empty(); });
+            std::vector<std::thread> finished;
+            for (size_t i = 0; i < finishedClients.size(); i++) {
+                for (size_t t = 0; t < clientThreads.size(); t++) {
+                    if (clientThreads[t].get_id() == finishedClients[i]) {
+                        finished.push_back(std::move(clientThreads[t]));
+                        clientThreads.erase(clientThreads.begin() + t);
+                        break;
+                    }
+                }
+            }
+            finishedClients.clear();
+
+            // The threads are only leaving clientLoop, but they are joined without the lock they may still need
+            lock.unlock();
+            for (size_t i = 0; i < finished.size(); i++)
+                finished[i].join();
+            lock.lock();
+            if (!reaping)
+                return;
+        }
+    }
+
+    // Predicts the queued frames in batches
+    void batchLoop() {
+        std::vector<std::shared_ptr<PendingFrame> > batch;
+        std::vector<cv::Mat> processed;
+        std::vector<int> predictions;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [&]() { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    break;
+
+                // Wait for the batch to fill, at most maxWaitMs
+                std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((int64_t)(maxWaitMs * 1000));
+                while ((int)queue.size() < maxBatch && !stopping)
+                    if (queueReady.wait_until(lock, deadline) == std::cv_status::timeout)
+                        break;
+
+                int count = std::min((int)queue.size(), maxBatch);
+                batch.assign(queue.begin(), queue.begin() + count);
+                queue.erase(queue.begin(), queue.begin() + count);
+            }
+
+            processed.resize(batch.size());
+            for (size_t i = 0; i < batch.size(); i++)
+                processed[i] = batch[i]->processed;
+            int64_t predictStartNs = Instrumentation::now();
+            predictProcessedBatch(model, processed, predictions);
+            int64_t predictEndNs = Instrumentation::now();
+            Instrumentation::record(predictStage, predictStartNs, predictEndNs);
+            batches++;
+
+            // The requests are measured until their prediction here rather than in the threads of the clients, which come and go
+            for (size_t i = 0; i < batch.size(); i++) {
+                Instrumentation::record(requestStage, batch[i]->receivedNs, predictEndNs);
+                batch[i]->label = predictions[i];
+                batch[i]->batchSize = (int)batch.size();
+                batch[i]->predictStartNs = predictStartNs;
+                batch[i]->predictEndNs = predictEndNs;
+                batch[i]->done.set_value();
+            }
+            batch.clear();
+        }
+    }
+
+    // Serves the requests of a client
+    void clientLoop(SocketHandle clientFd) {
+        RequestHeader request;
+        std::vector<uchar> payload;
+        // The client waits for the prediction of a frame before processing the next one, so the processed frame queued can stay in the workspace
+        PreprocessWorkspace workspace;
+        while (readFully(clientFd, &request, sizeof(request))) {
+            int64_t receivedNs = Instrumentation::now();
+            ResponseHeader response;
+            memset(&response, 0, sizeof(response));
+            response.magic = RESPONSE_MAGIC;
+
+            if (request.magic != REQUEST_MAGIC || request.payloadSize > MAX_PAYLOAD) {
+                errors++;
+                response.status = -1;
+                writeFully(clientFd, &response, sizeof(response));
+                break;
+            }
+            payload.resize(request.payloadSize);
+            if (request.payloadSize > 0 && !readFully(clientFd, &payload[0], payload.size()))
+                break;
+
+            if (request.type == REQUEST_STATS) {
+                std::string json = stats();
+                response.payloadSize = (uint32_t)json.size();
+                if (!writeFully(clientFd, &response, sizeof(response)) || !writeFully(clientFd, json.data(), json.size()))
+                    break;
+                continue;
+            }
+            if (request.type == REQUEST_SHUTDOWN) {
+                writeFully(clientFd, &response, sizeof(response));
+                stop();
+                break;
+            }
+
+            // Decode and process the frame in the thread of the client
+            cv::Mat frame;
+            if (request.type == REQUEST_ENCODED && !payload.empty())
+                frame = cv::imdecode(payload, cv::IMREAD_COLOR);
+            else if (request.type == REQUEST_RAW_BGR && request.width > 0 && request.height > 0
+                     && (uint64_t)request.width * request.height * 3 == request.payloadSize)
+                frame = cv::Mat((int)request.height, (int)request.width, CV_8UC3, &payload[0]);
+            if (frame.empty()) {
+                errors++;
+                response.status = -2;
+                if (!writeFully(clientFd, &response, sizeof(response)))
+                    break;
+                continue;
+            }
+            std::shared_ptr<PendingFrame> pending(new PendingFrame());
+            pending->processed = processImage(frame, hsvConfig, model.preprocessing, workspace);
+            pending->receivedNs = receivedNs;
+            pending->queuedNs = Instrumentation::now();
+            std::future<void> done = pending->done.get_future();
+
+            // Queue it for the next batch and wait for its prediction
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                if (stopping)
+                    break;
+                queue.push_back(pending);
+                if ((long long)queue.size() > maxQueueDepth)
+                    maxQueueDepth = (long long)queue.size();
+            }
+            queueReady.notify_one();
+            done.wait();
+
+            int64_t answeredNs = Instrumentation::now();
+            requests++;
+            response.label = pending->label;
+            response.batchSize = (uint32_t)pending->batchSize;
+            response.decodeMs = (float)((pending->queuedNs - receivedNs) / 1e6);
+            response.queueMs = (float)((pending->predictStartNs - pending->queuedNs) / 1e6);
+            response.predictMs = (float)((pending->predictEndNs - pending->predictStartNs) / 1e6);
+            response.totalMs = (float)((answeredNs - receivedNs) / 1e6);
+            if (!writeFully(clientFd, &response, sizeof(response)))
+                break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clientFds.erase(std::remove(clientFds.begin(), clientFds.end(), clientFd), clientFds.end());
+            finishedClients.push_back(std::this_thread::get_id());
+            closeSocket(clientFd);
+        }
+        clientFinished.notify_one();
+    }
+
+    static bool readFully(SocketHandle fd, void* data, size_t size) {
+        char* bytes = (char*)data;
+        while (size > 0) {
+            int n = (int)recv(fd, bytes, (int)std::min(size, (size_t)(1 << 30)), 0);
+#ifndef _WIN32
+            if (n < 0 && errno == EINTR)
+                continue;
+#endif
+            if (n <= 0)
+                return false;
+            bytes += n;
+            size -= (size_t)n;
+        }
+        return true;
+    }
+
+    static bool writeFully(SocketHandle fd, const void* data, size_t size) {
+        const char* bytes = (const char*)data;
+        while (size > 0) {
+            int n = (int)send(fd, bytes, (int)std::min(size, (size_t)(1 << 30)), SEND_FLAGS);
+#ifndef _WIN32
+            if (n < 0 && errno == EINTR)
+                continue;
+#endif
+            if (n <= 0)
+                return false;
+            bytes += n;
+            size -= (size_t)n;
+        }
+        return true;
+    }
+
+    const HandModel& model;
+    int hsvConfig[6];
+    int maxBatch;
+    double maxWaitMs;
+    SocketHandle listenFd;
+    std::atomic<bool> listenClosed;     // The listening socket was already shut down (closed on Windows) to stop the service
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<std::shared_ptr<PendingFrame> > queue;
+    std::atomic<bool> stopping;
+
+    std::mutex clientsMutex;
+    std::condition_variable clientFinished;
+    std::vector<SocketHandle> clientFds;                // Sockets of the connected clients
+    std::vector<std::thread> clientThreads;             // Threads of the connected clients
+    std::vector<std::thread::id> finishedClients;       // Threads of the clients that left, to be joined
+    bool reaping;                                       // If the finished clients are joined as they leave (until the service stops)
+
+    std::atomic<long long> requests;
+    std::atomic<long long> batches;
+    std::atomic<long long> errors;
+    std::atomic<long long> maxQueueDepth;
+    int64_t startNs;
+    int predictStage;
+    int requestStage;
+};
+
+#endif // PREDICTION_SERVER_H
@@ -0,0 +1,311 @@
+/**
+    Preprocessing of the images: thresholding, cleaning and resizing of the hand into the image given to the model.
+    Optionally the hand is located (the largest connected component of the mask) and only its bounding box is resized, so the processed image
+    is a small square with the hand normalized in position and size. Frames of a video can track the hand: only a window around its position
+    in the previous frame is processed.
+*/
+
+#ifndef PREPROCESSING_H
+#define PREPROCESSING_H
+
+#include <string>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "BinaryMorphology.h"
+#include "HsvThreshold.h"
+
+// Width of the camera and dataset images the blur and dilation sizes were tuned for
+static const int REFERENCE_WIDTH = 1280;
+
+// Width of the downscaled mask where the hand is located
+static const int LOCATE_WIDTH = 160;
+
+// Smallest fraction of the mask covered by the hand, smaller components are noise
+static const double MIN_HAND_AREA = 0.002;
+
+// Margin added around the bounding box of the hand when it is cropped, as a fraction of its size
+static const double CROP_MARGIN = 0.05;
+
+// Margin of the tracking window around the hand of the previous frame, as a fraction of its size
+static const double TRACK_MARGIN = 0.5;
+
+/**
+    Structure with the parameters of the preprocessing. They are stored with the model, so the training and the predictions always process the images the same way.
+*/
+struct PreprocessConfig {
+    int workWidth;          // Width the images are reduced to before thresholding them (the height keeps the aspect ratio). 0 keeps the original resolution
+    cv::Size featureSize;   // Size of the processed images given to the model
+    bool cropHand;          // If only the bounding box of the hand is resized to featureSize, instead of the whole image
+    std::string features;   // Name of the extractor of the features of the processed images (see FeatureExtractor.h)
+
+    PreprocessConfig() : workWidth(640), featureSize(160, 90), cropHand(false), features("raw") {}
+
+    /**
+        Returns: the configuration of the models trained before it was configurable: full resolution and 640x480 images.
+    */
+    static PreprocessConfig legacy() {
+        PreprocessConfig config;
+        config.workWidth = 0;
+        config.featureSize = cv::Size(640, 480);
+        return config;
+    }
+
+    /**
+        Returns: the configuration that crops the hand and normalizes it to a 64x64 image.
+    */
+    static PreprocessConfig cropped() {
+        PreprocessConfig config;
+        config.featureSize = cv::Size(64, 64);
+        config.cropHand = true;
+        return config;
+    }
+
+    bool isLegacy() const {
+        return workWidth <= 0;
+    }
+
+    /**
+        Returns: true if the hand is cropped (never with the legacy preprocessing).
+    */
+    bool cropsHand() const {
+        return cropHand && !isLegacy();
+    }
+
+    /**
+        Writes the configuration as the current node of a file storage.
+    */
+    void write(cv::FileStorage& fs) const {
+        fs << "{" << "work_width" << workWidth << "feature_width" << featureSize.width << "feature_height" << featureSize.height << "crop_hand" << (int)cropHand
+           << "features" << features << "}";
+    }
+
+    /**
+        Reads the configuration from a node written by write().
+        Returns: false if the node is empty (the model was stored without it).
+    */
+    bool read(const cv::FileNode& node) {
+        if (node.empty())
+            return false;
+        workWidth = (int)node["work_width"];
+        featureSize = cv::Size((int)node["feature_width"], (int)node["feature_height"]);
+        // Models stored before the hand could be cropped resize the whole image
+        cropHand = !node["crop_hand"].empty() && (int)node["crop_hand"] != 0;
+        // Models stored before the features could be chosen use the pixels of the processed images
+        features = node["features"].empty() ? std::string("raw") : (std::string)node["features"];
+        return true;
+    }
+};
+
+/**
+    Structure with the buffers used to process an image. A workspace kept between frames of the same size makes processImage reuse its buffers
+    instead of allocating them for every frame. It can't be shared between threads.
+*/
+struct PreprocessWorkspace {
+    cv::Mat work;       // Image at the working resolution
+    cv::Mat mask;       // Thresholded image
+    cv::Mat filtered;   // Median blur of the mask, when the OpenCV functions are used
+    cv::Mat dilated;    // Median blur and dilation of the mask
+    BinaryMorphology morphology;
+    cv::Mat result;     // Processed image
+    cv::Mat element;    // Structuring element of the dilation
+    int elementSize;
+    cv::Mat small;      // Downscaled mask where the hand is located
+    cv::Mat labels;     // Connected components of the downscaled mask
+    cv::Mat stats;
+    cv::Mat centroids;
+    bool trackHand;     // If the hand is searched around its position in the previous image (frames of a video, not independent images)
+    cv::Rect handBox;   // Bounding box of the hand in the previous image at the working resolution, empty if it was not found
+    cv::Size workSize;  // Working resolution of the previous image
+
+    PreprocessWorkspace() : elementSize(-1), trackHand(false) {}
+};
+
+/**
+    Function that locates the hand in a mask: the bounding box of its largest connected component.
+    The components are searched in the mask reduced to LOCATE_WIDTH, where a pixel is set if any pixel of the area it covers is set,
+    so the box covers the whole component at the resolution of the mask.
+    Params:
+        mask - The binary mask
+        workspace - The buffers of the processing
+    Returns: the bounding box of the hand in the mask, empty if there is no component big enough.
+*/
+inline cv::Rect locateHand(const cv::Mat& mask, PreprocessWorkspace& workspace){
+    int factor = std::max(1, mask.cols / LOCATE_WIDTH);
+    const cv::Mat* small = &mask;
+    if (factor > 1) {
+        cv::resize(mask, workspace.small, cv::Size(std::max(1, mask.cols / factor), std::max(1, mask.rows / factor)), 0, 0, cv::INTER_AREA);
+        cv::threshold(workspace.small, workspace.small, 0, 255, cv::THRESH_BINARY);
+        small = &workspace.small;
+    }
+
+    int numLabels = cv::connectedComponentsWithStats(*small, workspace.labels, workspace.stats, workspace.centroids, 8, CV_32S);
+    int best = -1;
+    int bestArea = std::max(1, cvRound(MIN_HAND_AREA * small->total()));
+    for (int i = 1; i < numLabels; i++) {
+        int area = workspace.stats.at<int>(i, cv::CC_STAT_AREA);
+        if (area >= bestArea) {
+            best = i;
+            bestArea = area;
+        }
+    }
+    if (best < 0)
+        return cv::Rect();
+
+    // Box of the component at the resolution of the mask
+    double fx = mask.cols / double(small->cols), fy = mask.rows / double(small->rows);
+    int left = workspace.stats.at<int>(best, cv::CC_STAT_LEFT), top = workspace.stats.at<int>(best, cv::CC_STAT_TOP);
+    int x0 = cvFloor(left * fx), y0 = cvFloor(top * fy);
+    int x1 = cvCeil((left + workspace.stats.at<int>(best, cv::CC_STAT_WIDTH)) * fx);
+    int y1 = cvCeil((top + workspace.stats.at<int>(best, cv::CC_STAT_HEIGHT)) * fy);
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(0, 0, mask.cols, mask.rows);
+}
+
+/**
+    Function that crops the bounding box of the hand from a mask and resizes it to the size of the processed image.
+    The box is expanded around its center to the aspect ratio of the processed image (plus CROP_MARGIN), so the hand keeps its proportions;
+    the parts of it out of the mask are background.
+    Params:
+        mask - The binary mask
+        box - The bounding box of the hand in the mask, empty if there is no hand (the result is all background)
+        size - The size of the processed image
+        result - The processed image (binary)
+*/
+inline void cropHandBox(const cv::Mat& mask, const cv::Rect& box, cv::Size size, cv::Mat& result){
+    result.create(size, CV_8U);
+    result.setTo(0);
+    if (box.area() == 0)
+        return;
+
+    double aspect = size.width / double(size.height);
+    double width = box.width, height = box.height;
+    if (width < height * aspect)
+        width = height * aspect;
+    else
+        height = width / aspect;
+    width *= 1 + 2 * CROP_MARGIN;
+    height *= 1 + 2 * CROP_MARGIN;
+    cv::Rect crop(cvFloor(box.x + box.width / 2.0 - width / 2), cvFloor(box.y + box.height / 2.0 - height / 2), cvCeil(width), cvCeil(height));
+
+    // Only the part of the crop inside the mask is resized, into its place in the processed image
+    cv::Rect visible = crop & cv::Rect(0, 0, mask.cols, mask.rows);
+    double sx = size.width / double(crop.width), sy = size.height / double(crop.height);
+    cv::Rect target(cvRound((visible.x - crop.x) * sx), cvRound((visible.y - crop.y) * sy), cvRound(visible.width * sx), cvRound(visible.height * sy));
+    target &= cv::Rect(0, 0, size.width, size.height);
+    if (target.area() == 0)
+        return;
+    cv::Mat dst = result(target);
+    cv::resize(mask(visible), dst, target.size(), 0, 0, cv::INTER_AREA);
+    cv::threshold(dst, dst, 127, 255, cv::THRESH_BINARY);
+}
+
+/**
+    Function that process an image applying a thresholding to find the best contour of a hand in dark background
+    The image is first reduced to the working resolution with area interpolation, so the threshold, the median blur and the dilation work on
+    less pixels, and their sizes are scaled to match. The final resize keeps the mask binary (each pixel is the majority of the area it covers).
+    If the configuration crops the hand, only its bounding box is resized. If the workspace tracks the hand and it was found in the previous image,
+    only a window around it is reduced and thresholded; when the hand is not found inside the window, or touches its border, the whole image is processed.
+    Params:
+        img - A matrix of the image to process
+        hsvConfig - The HSV Configuration to apply the threshold
+        config - The resolutions of the preprocessing
+        workspace - The buffers of the processing
+    Returns: A matrix of the processed image, stored in the workspace (it is overwritten by the next image processed with it).
+*/
+inline const cv::Mat& processImage(const cv::Mat& img, const int* hsvConfig, const PreprocessConfig& config, PreprocessWorkspace& workspace){
+
+    // Reduce the image (or the tracking window) to the working resolution
+    const cv::Mat* work = &img;
+    double scale = 1;
+    cv::Rect window;
+    cv::Mat windowView;     // The window of an image already at the working resolution (not in the workspace, it must not be written)
+    if (!config.isLegacy()) {
+        cv::Size workSize = img.size();
+        if (img.cols > config.workWidth)
+            workSize = cv::Size(config.workWidth, cvRound(img.rows * config.workWidth / double(img.cols)));
+        scale = workSize.width / double(REFERENCE_WIDTH);
+
+        if (workspace.trackHand && config.cropsHand() && workspace.handBox.area() > 0 && workspace.workSize == workSize) {
+            const cv::Rect& box = workspace.handBox;
+            int margin = cvCeil(TRACK_MARGIN * std::max(box.width, box.height));
+            window = cv::Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) & cv::Rect(cv::Point(), workSize);
+        }
+        workspace.workSize = workSize;
+        workspace.handBox = cv::Rect();
+
+        if (window.area() > 0 && workSize == img.size()) {
+            windowView = img(window);
+            work = &windowView;
+        } else if (window.area() > 0) {
+            double fx = img.cols / double(workSize.width), fy = img.rows / double(workSize.height);
+            cv::Rect source(cvFloor(window.x * fx), cvFloor(window.y * fy), 0, 0);
+            source.width = std::min(img.cols, cvCeil(window.br().x * fx)) - source.x;
+            source.height = std::min(img.rows, cvCeil(window.br().y * fy)) - source.y;
+            cv::resize(img(source), workspace.work, window.size(), 0, 0, cv::INTER_AREA);
+            work = &workspace.work;
+        } else if (workSize != img.size()) {
+            cv::resize(img, workspace.work, workSize, 0, 0, cv::INTER_AREA);
+            work = &workspace.work;
+        }
+    }
+
+    // Threshold the image with the specific HSV config in one pass, the same as cv::cvtColor(CV_BGR2HSV) followed by cv::inRange
+    thresholdHsv(*work, workspace.mask, hsvConfig);
+
+    // Sizes for the full resolution images, scaled to the working resolution
+    int blurSize = 2 * cvRound(2 * scale) + 1;
+    int elementSize = std::max(1, cvRound(5 * scale));
+    if (workspace.elementSize != elementSize) {
+        workspace.element = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * elementSize + 1, 2 * elementSize + 1), cv::Point(elementSize, elementSize));
+        workspace.elementSize = elementSize;
+    }
+
+    // Median blur and dilation over the bit-packed mask (bit-identical to medianBlur + dilate), with the OpenCV functions for the sizes it doesn't support
+    cv::Point anchor(elementSize, elementSize);
+    if (!workspace.morphology.medianDilate(workspace.mask, blurSize, workspace.element, anchor, workspace.dilated)) {
+        const cv::Mat* mask = &workspace.mask;
+        if (blurSize > 1) {
+            cv::medianBlur(workspace.mask, workspace.filtered, blurSize);
+            mask = &workspace.filtered;
+        }
+        cv::dilate(*mask, workspace.dilated, workspace.element, anchor);
+    }
+
+    // Crop the hand, or resize the whole image
+    if (config.cropsHand()) {
+        cv::Rect box = locateHand(workspace.dilated, workspace);
+        if (window.area() > 0) {
+            // The hand left the window (or may continue out of it): search it in the whole image
+            bool atBorder = (box.x == 0 && window.x > 0) || (box.y == 0 && window.y > 0)
+                            || (box.br().x == window.width && window.br().x < workspace.workSize.width)
+                            || (box.br().y == window.height && window.br().y < workspace.workSize.height);
+            if (box.area() == 0 || atBorder)
+                return processImage(img, hsvConfig, config, workspace);
+        }
+        cropHandBox(workspace.dilated, box, config.featureSize, workspace.result);
+        if (box.area() > 0)
+            workspace.handBox = box + window.tl();
+    } else if (config.isLegacy()) {
+        cv::resize(workspace.dilated, workspace.result, config.featureSize);
+    } else {
+        cv::resize(workspace.dilated, workspace.result, config.featureSize, 0, 0, cv::INTER_AREA);
+        cv::threshold(workspace.result, workspace.result, 127, 255, cv::THRESH_BINARY);
+    }
+
+    return workspace.result;
+
+}
+
+/**
+    Function that process an image applying a thresholding to find the best contour of a hand in dark background
+    Params:
+        img - A matrix of the image to process
+        hsvConfig - The HSV Configuration to apply the threshold
+        config - The resolutions of the preprocessing
+    Returns: A matrix of the processed image.
+*/
+inline cv::Mat processImage(const cv::Mat& img, const int* hsvConfig, const PreprocessConfig& config = PreprocessConfig()){
+    PreprocessWorkspace workspace;
+    return processImage(img, hsvConfig, config, workspace);
+}
+
+#endif // PREPROCESSING_H
@@ -0,0 +1,224 @@
+/**
+    PCA projection of the features, fitted over the training set and stored with the model, so the SVM is trained and evaluated over a few components
+    instead of every feature. The components are interleaved by blocks of 16 features, so a sample (8 bits or float) is read once and projected on all
+    of them with SIMD dot products: the weights of a block of features for every component are contiguous and stream from memory in order, while the
+    block of the sample stays in registers and the outputs stay in the L1 cache. Blocks of 8 bits samples where every feature is 0 are skipped.
+    For linear models the projection is folded into the weights of the scorers (see createModelScorers), so it is only run for the other kernels.
+*/
+
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+class PcaProjection {
+public:
+
+    // Number of features of each block of the interleaved components
+    static const int BLOCK = 16;
+
+    PcaProjection() : inputSize(0), componentCount(0), blockCount(0) {}
+
+    /**
+        Fits the projection over a set of samples.
+        Params:
+            data - A matrix with the samples (one per row, 8 bits or float). cv::PCA needs float samples, 8 bits ones are converted
+            retainedVariance - Fraction of the variance kept by the components (the number of components is the smallest that keeps it)
+            maxComponents - Maximum number of components, or 0 for no limit
+        Returns: true if the projection could be fitted.
+    */
+    bool fit(const cv::Mat& data, double retainedVariance, int maxComponents = 0) {
+        cv::Mat floatData = data;
+        if (data.type() != CV_32F)
+            data.convertTo(floatData, CV_32F);
+        cv::PCA pca(floatData, cv::noArray(), cv::PCA::DATA_AS_ROW, retainedVariance);
+        cv::Mat eigenvectors = pca.eigenvectors;
+        if (maxComponents > 0 && eigenvectors.rows > maxComponents)
+            eigenvectors = eigenvectors.rowRange(0, maxComponents);
+        return create(pca.mean, eigenvectors);
+    }
+
+    /**
+        Builds the projection from the mean of the samples and the components.
+        Params:
+            mean - The mean of the samples (one row, float)
+            eigenvectors - The components, one per row (float)
+        Returns: true if the projection could be built.
+    */
+    bool create(const cv::Mat& mean, const cv::Mat& eigenvectors) {
+        inputSize = componentCount = blockCount = 0;
+        if (mean.empty() || eigenvectors.empty() || (int)mean.total() != eigenvectors.cols)
+            return false;
+        mean.reshape(1, 1).convertTo(meanRow, CV_32F);
+        eigenvectors.convertTo(components, CV_32F);
+
+        inputSize = components.cols;
+        componentCount = components.rows;
+        blockCount = (inputSize + BLOCK - 1) / BLOCK;
+
+        // Interleave the components by blocks: [block][component][16], padded with zeros, and the projection of the mean
+        weights.assign((size_t)blockCount * componentCount * BLOCK, 0.f);
+        offsets.assign(componentCount, 0.f);
+        for (int c = 0; c < componentCount; c++) {
+            const float* e = components.ptr<float>(c);
+            double offset = 0;
+            for (int j = 0; j < inputSize; j++) {
+                weights[((size_t)(j / BLOCK) * componentCount + c) * BLOCK + j % BLOCK] = e[j];
+                offset += (double)e[j] * meanRow.at<float>(j);
+            }
+            offsets[c] = (float)offset;
+        }
+        return true;
+    }
+
+    bool empty() const { return componentCount == 0; }
+    int getInputSize() const { return inputSize; }
+    int getComponentCount() const { return componentCount; }
+
+    /**
+        Returns: the weights of the features in the component c.
+    */
+    const float* component(int c) const {
+        return components.ptr<float>(c);
+    }
+
+    /**
+        Returns: the projection of the mean of the samples on the component c (the projection of a sample is e_c * x minus it).
+    */
+    float offset(int c) const {
+        return offsets[c];
+    }
+
+    /**
+        Projects a sample of 8 bits features (the processed image, that must be continuous).
+        Params:
+            sample - The features of the sample
+            out - The projection, getComponentCount() values
+    */
+    void project(const uchar* sample, float* out) const {
+        projectBlocks(sample, out);
+    }
+
+    /**
+        Projects a sample of float features.
+        Params:
+            sample - The features of the sample
+            out - The projection, getComponentCount() values
+    */
+    void project(const float* sample, float* out) const {
+        projectBlocks(sample, out);
+    }
+
+    /**
+        Projects the rows of a matrix (8 bits or float) in parallel.
+        Params:
+            data - The samples, one per row
+            projected - The projections, one per row (float)
+    */
+    void projectRows(const cv::Mat& data, cv::Mat& projected) const {
+        CV_Assert(data.cols == inputSize && (data.type() == CV_8U || data.type() == CV_32F));
+        projected.create(data.rows, componentCount, CV_32F);
+        cv::parallel_for_(cv::Range(0, data.rows), [&](const cv::Range& range) {
+            for (int k = range.start; k < range.end; k++) {
+                if (data.type() == CV_8U)
+                    project(data.ptr<uchar>(k), projected.ptr<float>(k));
+                else
+                    project(data.ptr<float>(k), projected.ptr<float>(k));
+            }
+        });
+    }
+
+    /**
+        Writes the projection as the current node of a file storage.
+    */
+    void write(cv::FileStorage& fs) const {
+        fs << "{" << "mean" << meanRow << "eigenvectors" << components << "}";
+    }
+
+    /**
+        Reads the projection from a node written by write().
+        Returns: false if the node is empty or not valid.
+    */
+    bool read(const cv::FileNode& node) {
+        inputSize = componentCount = blockCount = 0;
+        if (node.empty())
+            return false;
+        cv::Mat mean, eigenvectors;
+        cv::read(node["mean"], mean);
+        cv::read(node["eigenvectors"], eigenvectors);
+        return create(mean, eigenvectors);
+    }
+
+private:
+
+    // Blocks of 8 bits features that are all 0 don't change the projection
+    static bool isZeroBlock(const uchar* x) {
+        uint64_t lo, hi;
+        memcpy(&lo, x, 8);
+        memcpy(&hi, x + 8, 8);
+        return (lo | hi) == 0;
+    }
+    static bool isZeroBlock(const float*) {
+        return false;
+    }
+
+    template <typename T>
+    void projectBlocks(const T* sample, float* out) const {
+        // 4 partial sums per component, kept across the blocks and added once at the end (reused by the thread, as the count has no limit)
+        static thread_local std::vector<float> accBuffer;
+        accBuffer.assign((size_t)componentCount * 4, 0.f);
+        float (*acc)[4] = reinterpret_cast<float (*)[4]>(&accBuffer[0]);
+
+        float x[BLOCK];
+        int fullBlocks = inputSize / BLOCK;
+        for (int b = 0; b < blockCount; b++) {
+            const T* block = sample + b * BLOCK;
+            if (b < fullBlocks) {
+                if (isZeroBlock(block))
+                    continue;
+                for (int k = 0; k < BLOCK; k++)
+                    x[k] = (float)block[k];
+            } else {
+                for (int k = 0; k < BLOCK; k++)
+                    x[k] = b * BLOCK + k < inputSize ? (float)block[k] : 0.f;
+            }
+            accumulateBlock(x, &weights[(size_t)b * componentCount * BLOCK], acc);
+        }
+
+        for (int c = 0; c < componentCount; c++)
+            out[c] = acc[c][0] + acc[c][1] + acc[c][2] + acc[c][3] - offsets[c];
+    }
+
+    // Adds the products of a block of 16 features with the weights of every component
+    void accumulateBlock(const float* x, const float* w, float acc[][4]) const {
+#if CV_SIMD128
+        cv::v_float32x4 x0 = cv::v_load(x), x1 = cv::v_load(x + 4), x2 = cv::v_load(x + 8), x3 = cv::v_load(x + 12);
+        for (int c = 0; c < componentCount; c++, w += BLOCK) {
+            cv::v_float32x4 sum = cv::v_load(acc[c]);
+            sum = cv::v_muladd(x0, cv::v_load(w), sum);
+            sum = cv::v_muladd(x1, cv::v_load(w + 4), sum);
+            sum = cv::v_muladd(x2, cv::v_load(w + 8), sum);
+            sum = cv::v_muladd(x3, cv::v_load(w + 12), sum);
+            cv::v_store(acc[c], sum);
+        }
+#else
+        for (int c = 0; c < componentCount; c++, w += BLOCK)
+            for (int k = 0; k < BLOCK; k++)
+                acc[c][k & 3] += x[k] * w[k];
+#endif
+    }
+
+    int inputSize;
+    int componentCount;
+    int blockCount;
+    cv::Mat meanRow;            // Mean of the samples (one row)
+    cv::Mat components;         // Components, one per row, as fitted (kept to store them and to fold them into linear models)
+    std::vector<float> weights; // Components interleaved by blocks
+    std::vector<float> offsets; // Projection of the mean on each component
+};
+
+#endif // PROJECTION_H
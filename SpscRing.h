@@ -0,0 +1,96 @@
+/**
+    Bounded lock-free ring buffer for one producer thread and one consumer thread, used to connect the stages of the prediction pipeline.
+    The producer only writes the tail and the consumer only writes the head, so pushing and popping are a load and a store each (no locks, no CAS).
+    Neither side blocks: push fails when the ring is full and pop fails when it is empty, the caller decides whether to wait or drop.
+    popLatest implements the drop-oldest policy from the consumer side: it takes the newest item and discards the older ones still waiting,
+    so a slow stage always works on the freshest frame instead of falling behind the camera.
+*/
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class SpscRing {
+public:
+
+    /**
+        Creates the ring.
+        Params:
+            capacity - Maximum number of items waiting in the ring (at least 1)
+    */
+    explicit SpscRing(size_t capacity) : slots(capacity > 0 ? capacity + 1 : 2), head(0), tail(0) {}
+
+    /**
+        Adds an item at the end of the ring. Only the producer thread can call it.
+        Returns: true if the item was added, false if the ring is full (the item is left untouched).
+    */
+    bool push(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = t + 1 == slots.size() ? 0 : t + 1;
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+        slots[t] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /**
+        Takes the oldest item of the ring. Only the consumer thread can call it.
+        Returns: true if there was an item, false if the ring is empty.
+    */
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = std::move(slots[h]);
+        slots[h] = T();
+        head.store(h + 1 == slots.size() ? 0 : h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+        Takes the newest item of the ring and discards the older ones. Only the consumer thread can call it.
+        Params:
+            item - The newest item
+            dropped - Number of older items discarded
+        Returns: true if there was an item, false if the ring is empty.
+    */
+    bool popLatest(T& item, int& dropped) {
+        dropped = 0;
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        if (h == t)
+            return false;
+        size_t last = t == 0 ? slots.size() - 1 : t - 1;
+        for (; h != last; h = h + 1 == slots.size() ? 0 : h + 1, dropped++)
+            slots[h] = T();
+        item = std::move(slots[last]);
+        slots[last] = T();
+        head.store(t, std::memory_order_release);
+        return true;
+    }
+
+    /**
+        Returns: the number of items waiting in the ring (only exact when called from the producer or the consumer with the other one stopped).
+    */
+    size_t size() const {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return t >= h ? t - h : t + slots.size() - h;
+    }
+
+private:
+    std::vector<T> slots;                   // One slot more than the capacity, to tell a full ring from an empty one
+    alignas(64) std::atomic<size_t> head;   // Next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail;   // Next slot to push, written by the producer
+
+    SpscRing(const SpscRing&);
+    SpscRing& operator=(const SpscRing&);
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,243 @@
+/**
+    Streaming training of linear SVM models: the dataset is read in mini-batches of processed images (from the feature cache when it is valid,
+    or decoding and processing the images) and an online learner updates the one-vs-one decision functions with each batch, so the memory used
+    is one batch plus the weights, whatever the number of images. cv::ml::SVMSGD only solves binary problems and restarts on every train call,
+    so the learner is a Pegasos-style SGD over the same objective as the C_SVC of SVM::train, one binary problem per pair of classes.
+    It can start from the weights of a stored linear model (warm start), to add new labelled images without training from scratch.
+*/
+
+#ifndef STREAMING_TRAINER_H
+#define STREAMING_TRAINER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/ml/ml.hpp>
+#include "BitPacked.h"
+#include "CrossValidation.h"
+#include "Dataset.h"
+#include "FeatureCache.h"
+#include "ImageLoader.h"
+#include "LinearTrainer.h"
+#include "Model.h"
+#include "Preprocessing.h"
+#include "ThreadPool.h"
+
+/**
+    Reader of mini-batches of processed images of the dataset.
+*/
+class DatasetBatchReader {
+public:
+
+    /**
+        Prepares the reader.
+        Params:
+            entries - The images of the dataset, as listed by listDataset
+            hsvConfig - The HSV configuration used to process the images
+            config - The preprocessing of the images
+            cache - The feature cache of the same entries, or NULL to process the images
+    */
+    DatasetBatchReader(const std::vector<DatasetEntry>& entries, const int* hsvConfig, const PreprocessConfig& config, const FeatureCache* cache)
+        : entries(entries), hsvConfig(hsvConfig), config(config), cache(cache) {}
+
+    /**
+        Reads a batch of processed images.
+        Params:
+            indices - The positions of the images in the entries
+            pool - The pool where the images are processed in parallel
+            batch - The processed images, one per row (8 bits). Its buffer is reused between batches of the same size
+            classes - The class of each image
+            valid - If each image could be read
+    */
+    void read(const std::vector<int>& indices, WorkStealingPool& pool, cv::Mat& batch, std::vector<int>& classes, std::vector<bool>& valid) const {
+        int numVars = config.featureSize.area();
+        batch.create((int)indices.size(), numVars, CV_8U);
+        classes.resize(indices.size());
+        valid.assign(indices.size(), true);
+        pool.parallelFor(0, (int)indices.size(), [&](int k) {
+            int i = indices[k];
+            classes[k] = entries[i].classImg;
+            uchar* row = batch.ptr<uchar>(k);
+            if (cache != NULL && cache->isPacked()) {
+                unpackMask(cache->packedSample(i), numVars, row);
+            } else if (cache != NULL) {
+                memcpy(row, cache->sample(i).ptr<uchar>(), numVars);
+            } else {
+                cv::Mat img;
+                if (!readImage(entries[i].path, config.workWidth, img)) {
+                    valid[k] = false;
+                    memset(row, 0, numVars);
+                    return;
+                }
+                cv::Mat processed = processImage(img, hsvConfig, config);
+                memcpy(row, processed.ptr<uchar>(), numVars);
+            }
+        });
+    }
+
+private:
+    const std::vector<DatasetEntry>& entries;
+    const int* hsvConfig;
+    PreprocessConfig config;
+    const FeatureCache* cache;
+};
+
+/**
+    Online learner of the one-vs-one decision functions of a linear SVM (Pegasos: stochastic subgradient steps on the hinge loss).
+    The features are scaled to [0, 1] inside the learner and the weights are given back for the 0/255 images, so the objective is the one of a
+    C_SVC with the same C over the images (lambda = 1 / (C * n * 255^2)). Each weight vector is kept as scale * v, so the shrinking of every step
+    is one multiplication.
+*/
+class OnlineLinearSvm {
+public:
+
+    OnlineLinearSvm() : numVars(0), lambda(0), t0(0) {}
+
+    /**
+        Starts the learner with zero weights.
+        Params:
+            classLabels - The labels of the classes, sorted in ascending order
+            numVars - Number of features of the samples
+            C - The penalty of the errors, as in the C_SVC
+            numSamples - Number of training samples of the dataset
+    */
+    void create(const std::vector<int>& classLabels, int numVars, double C, int numSamples) {
+        labels = classLabels;
+        this->numVars = numVars;
+        lambda = 1.0 / (C * std::max(1, numSamples) * FEATURE_SCALE * FEATURE_SCALE);
+        // The first steps are as big as a step that moves the margin of an average sample by 1 (a third of the features are 255)
+        t0 = 1.0 / (lambda * (numVars / 3.0 + 1));
+        int numPairs = (int)labels.size() * ((int)labels.size() - 1) / 2;
+        pairs.assign(numPairs, PairState());
+        for (int p = 0; p < numPairs; p++)
+            pairs[p].v.assign(numVars, 0.f);
+    }
+
+    /**
+        Starts the learner from the weights of a linear model.
+        Params:
+            model - The model, it must have a linear scorer with the same classes and features
+            stepsSeen - Number of steps already done by each decision function, so the steps continue as small as they were
+        Returns: false if the model can't be used to start the learner.
+    */
+    bool warmStart(const HandModel& model, long long stepsSeen) {
+        if (model.scorer.empty() || model.scorer.getVarCount() != numVars || model.scorer.getClassLabels() != labels)
+            return false;
+        for (int p = 0; p < (int)pairs.size(); p++) {
+            PairState& pair = pairs[p];
+            for (int j = 0; j < numVars; j++)
+                pair.v[j] = model.scorer.weight(p, j) * (float)FEATURE_SCALE;
+            pair.scale = 1;
+            pair.bias = -model.scorer.getRho(p);
+            pair.steps = stepsSeen;
+        }
+        return true;
+    }
+
+    /**
+        Updates the decision functions with a batch of samples, each sample once in the order of the batch. The pairs are updated in parallel.
+        Params:
+            batch - The samples, one per row (8 bits)
+            classes - The class of each sample
+            valid - If each sample has to be used
+            pool - The pool where the pairs are updated
+    */
+    void partialFit(const cv::Mat& batch, const std::vector<int>& classes, const std::vector<bool>& valid, WorkStealingPool& pool) {
+        std::vector<int> classIdx(classes.size());
+        for (size_t k = 0; k < classes.size(); k++) {
+            size_t c = std::lower_bound(labels.begin(), labels.end(), classes[k]) - labels.begin();
+            classIdx[k] = c < labels.size() && labels[c] == classes[k] && valid[k] ? (int)c : -1;
+        }
+
+        pool.parallelFor(0, (int)pairs.size(), [&](int p) {
+            int first, second;
+            pairClasses(p, first, second);
+            for (int k = 0; k < batch.rows; k++)
+                if (classIdx[k] == first || classIdx[k] == second)
+                    step(pairs[p], batch.ptr<uchar>(k), classIdx[k] == first ? 1 : -1);
+        });
+    }
+
+    /**
+        Returns: an OpenCV SVM with the current decision functions (as one trained with SVM::train), empty if it could not be built.
+    */
+    cv::Ptr<cv::ml::SVM> createSvm(const SvmParams& params) const {
+        std::vector<float> pairWeights((size_t)pairs.size() * numVars);
+        std::vector<double> pairRho(pairs.size());
+        for (size_t p = 0; p < pairs.size(); p++) {
+            float factor = (float)(pairs[p].scale / FEATURE_SCALE);
+            for (int j = 0; j < numVars; j++)
+                pairWeights[p * numVars + j] = pairs[p].v[j] * factor;
+            pairRho[p] = -pairs[p].bias;
+        }
+        return createLinearSvm(pairWeights, pairRho, labels, numVars, params);
+    }
+
+    /**
+        Returns: the bytes used by the weights of the learner.
+    */
+    size_t memoryBytes() const {
+        return pairs.size() * (sizeof(PairState) + (size_t)numVars * sizeof(float));
+    }
+
+    const std::vector<int>& getClassLabels() const { return labels; }
+
+private:
+
+    // Value of the features of the 0/255 images scaled to 1
+    static constexpr double FEATURE_SCALE = 255.0;
+
+    struct PairState {
+        std::vector<float> v;   // The weights are scale * v, for the features scaled to [0, 1]
+        double scale;
+        double bias;
+        long long steps;
+
+        PairState() : scale(1), bias(0), steps(0) {}
+    };
+
+    // Classes of the decision function p, in the order the SVM stores them (0-1, 0-2, ..., 1-2, ...)
+    void pairClasses(int p, int& first, int& second) const {
+        int numClasses = (int)labels.size();
+        for (first = 0; p >= numClasses - 1 - first; first++)
+            p -= numClasses - 1 - first;
+        second = first + 1 + p;
+    }
+
+    // One step of the learner with a sample of class y (+1 for the first class of the pair, -1 for the second)
+    void step(PairState& pair, const uchar* x, int y) const {
+        double eta = 1.0 / (lambda * (pair.steps + t0));
+        pair.steps++;
+
+        float dot = 0;
+        for (int j = 0; j < numVars; j++)
+            dot += pair.v[j] * x[j];
+        double margin = y * (pair.scale * dot / FEATURE_SCALE + pair.bias);
+
+        pair.scale *= 1 - eta * lambda;
+        if (margin < 1) {
+            float delta = (float)(eta * y / (pair.scale * FEATURE_SCALE));
+            for (int j = 0; j < numVars; j++)
+                pair.v[j] += delta * x[j];
+            // The bias is not regularized, its steps start at 1 and decrease as 1 / t like the rest
+            pair.bias += eta * y * lambda * t0;
+        }
+        if (pair.scale < 1e-6) {
+            for (int j = 0; j < numVars; j++)
+                pair.v[j] *= (float)pair.scale;
+            pair.scale = 1;
+        }
+    }
+
+    std::vector<int> labels;
+    int numVars;
+    double lambda;
+    double t0;                      // Offset of the steps, so the first ones are not too big
+    std::vector<PairState> pairs;
+};
+
+#endif // STREAMING_TRAINER_H
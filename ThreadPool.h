@@ -0,0 +1,260 @@
+/**
+    Work-stealing thread pool used to spread independent jobs (image decoding, preprocessing, training...) over all the cores.
+    Every worker owns a queue of tasks: it takes work from the back of its own queue and, when that is empty,
+    steals from the front of the queues of the other workers, so long and short jobs end up balanced between the threads.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+
+    /**
+        Creates the pool and launches its workers.
+        Params:
+            numThreads - Number of worker threads. If it is 0 or less, one thread per available core is used.
+    */
+    explicit WorkStealingPool(int numThreads = 0) : pending(0), stopping(false), nextQueue(0) {
+        if (numThreads <= 0)
+            numThreads = (int)std::thread::hardware_concurrency();
+        if (numThreads <= 0)
+            numThreads = 1;
+
+        queues.resize(numThreads);
+        for (int i = 0; i < numThreads; i++)
+            queues[i] = new TaskQueue();
+        for (int i = 0; i < numThreads; i++)
+            workers.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+    }
+
+    /**
+        Waits for the workers to finish the tasks already submitted and stops them.
+    */
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+        for (size_t i = 0; i < queues.size(); i++)
+            delete queues[i];
+    }
+
+    /**
+        Returns: the number of worker threads of the pool.
+    */
+    int size() const {
+        return (int)workers.size();
+    }
+
+    /**
+        Adds a task to the pool. Tasks submitted from a worker go to its own queue, the rest are spread round-robin.
+        Params:
+            task - The function to run in one of the workers
+    */
+    void submit(const std::function<void()>& task) {
+        int q = currentWorker();
+        if (q < 0)
+            q = (int)(nextQueue++ % queues.size());
+
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(queues[q]->mutex);
+            queues[q]->tasks.push_back(task);
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wakeUp.notify_one();
+        // Workers waiting for a parallelFor of their own can run it too
+        allDone.notify_all();
+    }
+
+    /**
+        Blocks until every submitted task has finished.
+        If any of the tasks threw an exception, the first one is rethrown here.
+        It can't be called from a task of the pool (the task itself would be one of the ones waited for): tasks use parallelFor instead.
+    */
+    void wait() {
+        if (currentWorker() >= 0)
+            throw std::logic_error("WorkStealingPool::wait called from one of its own workers");
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        allDone.wait(lock, [this] { return pending.load() == 0; });
+
+        if (firstError) {
+            std::exception_ptr error = firstError;
+            firstError = std::exception_ptr();
+            std::rethrow_exception(error);
+        }
+    }
+
+    /**
+        Runs f(i) for every i in [begin, end) in the pool and waits until all of them are done.
+        It only waits for its own tasks, so it can be called from a task of the pool: that worker runs queued tasks while it waits.
+        If any f(i) threw an exception, the first one is rethrown here.
+        Params:
+            begin - First index
+            end - One past the last index
+            f - Function called with each index
+    */
+    template<typename F>
+    void parallelFor(int begin, int end, F f) {
+        if (end <= begin)
+            return;
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>(end - begin);
+        for (int i = begin; i < end; i++) {
+            submit([this, f, i, batch]() {
+                try {
+                    f(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(sleepMutex);
+                    if (!batch->error)
+                        batch->error = std::current_exception();
+                }
+                if (--batch->remaining == 0) {
+                    std::lock_guard<std::mutex> lock(sleepMutex);
+                    allDone.notify_all();
+                }
+            });
+        }
+
+        int self = currentWorker();
+        while (batch->remaining.load() > 0) {
+            std::function<void()> task;
+            if (self >= 0 && takeTask(self, task)) {
+                runTask(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            allDone.wait(lock, [&] { return batch->remaining.load() == 0 || (self >= 0 && hasQueuedTasks()); });
+        }
+
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        if (batch->error)
+            std::rethrow_exception(batch->error);
+    }
+
+private:
+
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    // Tasks of one parallelFor that didn't finish yet, and the first exception thrown by them
+    struct Batch {
+        std::atomic<int> remaining;
+        std::exception_ptr error;
+
+        explicit Batch(int count) : remaining(count) {}
+    };
+
+    /**
+        Returns: the index of the worker of this pool running the calling thread, or -1 if it is not one of them.
+    */
+    int currentWorker() const {
+        std::thread::id self = std::this_thread::get_id();
+        for (size_t i = 0; i < workers.size(); i++)
+            if (workers[i].get_id() == self)
+                return (int)i;
+        return -1;
+    }
+
+    /**
+        Takes the next task for a worker: first from the back of its own queue, then from the front of the others.
+    */
+    bool takeTask(int self, std::function<void()>& task) {
+        {
+            TaskQueue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); k++) {
+            TaskQueue& victim = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+        Runs a task taken from the queues, keeping its exception for wait().
+    */
+    void runTask(std::function<void()>& task) {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            if (!firstError)
+                firstError = std::current_exception();
+        }
+
+        if (--pending == 0) {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+            }
+            allDone.notify_all();
+            // Idle workers of a stopping pool are waiting for the last task to finish
+            wakeUp.notify_all();
+        }
+    }
+
+    void workerLoop(int self) {
+        while (true) {
+            std::function<void()> task;
+            if (takeTask(self, task)) {
+                runTask(task);
+                continue;
+            }
+
+            // Nothing to run or steal: sleep until new work arrives, or until every task is done if the pool is stopping
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeUp.wait(lock, [this] { return hasQueuedTasks() || (stopping && pending.load() == 0); });
+            if (stopping && pending.load() == 0 && !hasQueuedTasks())
+                return;
+        }
+    }
+
+    bool hasQueuedTasks() {
+        for (size_t i = 0; i < queues.size(); i++) {
+            std::lock_guard<std::mutex> lock(queues[i]->mutex);
+            if (!queues[i]->tasks.empty())
+                return true;
+        }
+        return false;
+    }
+
+    std::vector<TaskQueue*> queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> pending;
+    bool stopping;
+    std::atomic<unsigned> nextQueue;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::condition_variable allDone;
+    std::exception_ptr firstError;
+};
+
+#endif // THREAD_POOL_H
@@ -7,9 +7,28 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/ml/ml.hpp>
-#include "Clock.h"
-#include "dirent.h"
+#include "ChangeGate.h"
+#include "CrossValidation.h"
+#include "Dataset.h"
+#include "Evaluation.h"
+#include "FeatureCache.h"
+#include "FrameSource.h"
+#include "HsvCalibration.h"
+#include "ImageLoader.h"
+#include "Instrumentation.h"
+#include "LinearTrainer.h"
+#include "Model.h"
+#include "ModelBundle.h"
+#include "PredictionServer.h"
+#include "Preprocessing.h"
+#include "SpscRing.h"
+#include "StreamingTrainer.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <memory>
+#include <thread>
 #include <vector>
 #include <fstream>
 
@@ -18,6 +37,47 @@ using namespace std;
 using namespace cv;
 using namespace cv::ml;
 
+// File where the processed images of the dataset are cached between runs
+const char* FEATURE_CACHE_FILE = "features.cache";
+
+// Binary bundle of the linear model stored in HandNumbersClassifier_01.dat, loaded without parsing by the prediction modes
+const char* MODEL_BUNDLE_FILE = "HandNumbersClassifier_01.bin";
+
+// Static values for perfect threshold of training test images, in the format: {minH, maxH, minS, maxS, minV, maxV}
+//const int DATASET_HSV_CONFIG [6]= {10, 160, 10, 200, 10, 130};
+const int DATASET_HSV_CONFIG [6]= {10, 160, 0, 200, 10, 130};
+
+// Files where the measures of the instrumentation are written (summary as CSV and JSON, and the events for chrome://tracing)
+const char* PROFILE_CSV_FILE = "profile.csv";
+const char* PROFILE_JSON_FILE = "profile.json";
+const char* PROFILE_TRACE_FILE = "profile_trace.json";
+
+// Stages and counters measured by the instrumentation
+const int STAGE_READ_IMAGE = Instrumentation::stage("createData: decode");
+const int STAGE_PROCESS_IMAGE = Instrumentation::stage("createData: processImage");
+const int STAGE_LOAD_IMAGES = Instrumentation::stage("createData: load images");
+const int STAGE_FILL_SETS = Instrumentation::stage("createData: fill sets");
+const int STAGE_CREATE_DATA = Instrumentation::stage("createData");
+const int STAGE_TRAIN = Instrumentation::stage("train");
+const int STAGE_TRAIN_LINEAR = Instrumentation::stage("train: linear dual coordinate descent");
+const int STAGE_FIT_PROJECTION = Instrumentation::stage("train: fit PCA projection");
+const int STAGE_READ_BATCH = Instrumentation::stage("train: read batch");
+const int STAGE_TRAIN_BATCH = Instrumentation::stage("train: online update of a batch");
+const int STAGE_CAPTURE = Instrumentation::stage("camera: capture");
+const int STAGE_PROCESS_FRAME = Instrumentation::stage("camera: processImage");
+const int STAGE_PREDICT = Instrumentation::stage("camera: predict");
+const int STAGE_DISPLAY = Instrumentation::stage("camera: display");
+const int STAGE_END_TO_END = Instrumentation::stage("camera: capture to prediction");
+const int COUNTER_FRAMES = Instrumentation::counter("frames");
+const int COUNTER_DROPPED_FRAMES = Instrumentation::counter("dropped frames");
+const int COUNTER_PREDICTIONS = Instrumentation::counter("predictions");
+const int COUNTER_EVALUATED_FRAMES = Instrumentation::counter("evaluated frames");
+const int COUNTER_UNCHANGED_FRAMES = Instrumentation::counter("skipped frames: unchanged");
+const int COUNTER_COOLDOWN_FRAMES = Instrumentation::counter("skipped frames: cooldown");
+const int COUNTER_IMAGE_BYTES = Instrumentation::counter("createData: bytes read");
+
+// Time after a predicted gesture during which the next frames are not classified
+const int64_t COOLDOWN_NS = (int64_t)3e9;
 
 /**
     Function that trims from the start a string in place
@@ -31,9 +91,12 @@ static inline void ltrim(std::string &s) {
 
 /**
     Function that reads the HSV config file (hsv.config).
-    Returns: an array of integers with the values of the HSV configuration in the format: {minH, maxH, minS, maxS, minV, maxV}
+    Params:
+        out - The array where the values of the HSV configuration are written, in the format: {minH, maxH, minS, maxS, minV, maxV}.
+              It is not changed if the file can't be read
+    Returns: true if the file was read, false otherwise.
 */
-int* readHsvConfigFile(){
+bool readHsvConfigFile(int out[6]){
 
     int hsvConfig [6];
     bool badReading = false;
@@ -43,14 +106,15 @@ int* readHsvConfigFile(){
         while ( getline (myfile,line) )
         {
             ltrim(line);
-            if(line.at(0) != '#' && line.c_str() != ""){
+            if(!line.empty() && line.at(0) != '#'){
                 //cout << line << '\n';
 
                 stringstream splitted (line);
                 int i = 0;
                 string strNum;
                 while(splitted >> strNum){
-                    hsvConfig[i] = atoi( strNum.c_str() );
+                    if (i < 6)
+                        hsvConfig[i] = atoi( strNum.c_str() );
                     i++;
                 }
 
@@ -65,9 +129,9 @@ int* readHsvConfigFile(){
         badReading = true;
 
     if (badReading)
-        return NULL;
-    else
-        return hsvConfig;
+        return false;
+    std::copy(hsvConfig, hsvConfig + 6, out);
+    return true;
 }
 
 /**
@@ -90,49 +154,102 @@ void writeHsvConfig(int * hsvConfig){
 }
 
 /**
-    Function that process an image applying a thresholding to find the best contour of a hand in dark background
+    Function that gets the HSV configuration used to process the frames of a source.
     Params:
-        img - A matrix of the image to process
-        hsvConfig - The HSV Configuration to apply the threshold
-    Returns: A matrix of the processed image.
+        hsvConfig - The array where the HSV configuration is written, in the format: {minH, maxH, minS, maxS, minV, maxV}
+        datasetImages - If the frames are images taken like the ones of the dataset, that use the threshold of the training
 */
-Mat processImage(Mat img, int* hsvConfig){
+void loadHsvConfig(int* hsvConfig, bool datasetImages){
+    if (datasetImages || !readHsvConfigFile(hsvConfig)) {
+        if (!datasetImages)
+            cout << "Error reading the HSV Config File, using the threshold of the training images" << endl;
+        std::copy(DATASET_HSV_CONFIG, DATASET_HSV_CONFIG + 6, hsvConfig);
+    }
+}
 
-    // Get the specific HSV config
-    int minH = hsvConfig[0], maxH = hsvConfig[1], minS = hsvConfig[2], maxS = hsvConfig[3], minV = hsvConfig[4], maxV = hsvConfig[5];
+/**
+    Function that prints the measures of the instrumentation and writes them in the profile files.
+*/
+void writeProfile(){
+    cout << endl << "Profile" << endl;
+    Instrumentation::print(cout);
+    if (!Instrumentation::writeCsv(PROFILE_CSV_FILE) || !Instrumentation::writeJson(PROFILE_JSON_FILE) || !Instrumentation::writeChromeTrace(PROFILE_TRACE_FILE))
+        cout << "Error writing the profile files" << endl;
+    else
+        cout << "Profile written in " << PROFILE_CSV_FILE << ", " << PROFILE_JSON_FILE << " and " << PROFILE_TRACE_FILE << endl;
+}
 
-    cv::Mat hsv;
-    cv::cvtColor(img, hsv, CV_BGR2HSV);
-    cv::inRange(hsv, cv::Scalar(minH, minS, minV), cv::Scalar(maxH, maxS, maxV), hsv);
-    int blurSize = 5;
-    int elementSize = 5;
-    cv::medianBlur(hsv, hsv, blurSize);
-    cv::Mat element = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * elementSize + 1, 2 * elementSize + 1), cv::Point(elementSize, elementSize));
-    cv::dilate(hsv, hsv, element);
+/**
+    Function that scales a processed image to a size that can be seen on the screen, without mixing its pixels.
+    Params:
+        processed - The processed image
+    Returns: A matrix of the image to show.
+*/
+Mat displayImage(const Mat& processed){
+    Mat display;
+    int width = 640;
+    cv::resize(processed, display, Size(width, width * processed.rows / processed.cols), 0, 0, INTER_NEAREST);
+    return display;
+}
 
-    // Resize image
-    Size sizeImg(640, 480);
-    cv::resize(hsv, hsv, sizeImg);
+/**
+    Structure with the region of the frame labelled as the hand in the camera configuration, dragged with the mouse.
+*/
+struct CalibrationRegion {
+    Rect region;
+    Point start;
+    bool dragging;
+    bool changed;       // The region was drawn again, so the labels collected with the previous one are forgotten
 
-    return hsv;
+    CalibrationRegion() : dragging(false), changed(false) {}
+};
 
+/**
+    Function called by the window of the camera configuration for the mouse events: dragging the mouse labels the region of the hand.
+*/
+void onCalibrationMouse(int event, int x, int y, int, void* userdata){
+    CalibrationRegion* region = (CalibrationRegion*)userdata;
+    if (event == EVENT_LBUTTONDOWN) {
+        region->start = Point(x, y);
+        region->region = Rect();
+        region->dragging = true;
+    } else if (event == EVENT_MOUSEMOVE && region->dragging) {
+        region->region = Rect(region->start, Point(x, y));
+    } else if (event == EVENT_LBUTTONUP && region->dragging) {
+        region->region = Rect(region->start, Point(x, y));
+        region->dragging = false;
+        region->changed = true;
+    }
 }
 
 /**
     Function to configure the camera in order to find the best HSV configuration for the thresholding process for the images.
     It reads the current configuration from the hsv.config file and when the user is done configuring it writes the new configuration into the file.
+    Each frame is converted to HSV once and the sliders only change the tables the preview is thresholded with (see HsvCalibration), so a paused
+    frame can be tuned without processing it again. Dragging a rectangle over the hand labels it as the foreground (and the frame away from it as
+    the background) in every frame captured after it, and the automatic mode picks the thresholds that best separate both.
+    Params:
+        source - The source of the frames, the camera if it is empty (videos and folders of images are replayed at their frame rate)
 */
-void configureCamera(){
+void configureCamera(Ptr<FrameSource> source = Ptr<FrameSource>()){
 
     // Print the instructions
-    cout << "Use the sliders to find the best configuration possible. Press any key when you are done..." << endl;
+    cout << "Use the sliders to find the best configuration possible. Drag a rectangle over the hand to label it." << endl;
+    cout << "Keys: space - pause/resume, a - automatic thresholds from the labelled frames, r - forget the labels. Press any other key when you are done..." << endl;
 
     // Launch the camera
-    cv::VideoCapture cap(0);
+    if (source.empty())
+        source = openFrameSource("camera");
+    if (!source->isOpened()) {
+        cout << "Error opening the source of frames: " << source->name() << endl;
+        return;
+    }
+    int frameDelay = source->fps() > 0 ? max(1, cvRound(1000 / source->fps())) : 30;
 
     // Read the values in the config file
     //int minH = 130, maxH = 160, minS = 10, maxS = 40, minV = 75, maxV = 130;
-    int* hsvConfig = readHsvConfigFile();
+    int hsvConfig [6];
+    loadHsvConfig(hsvConfig, false);
     int minH = hsvConfig[0], maxH = hsvConfig[1], minS = hsvConfig[2], maxS = hsvConfig[3], minV = hsvConfig[4], maxV = hsvConfig[5];
 
     // Create the window to show the help image
@@ -153,25 +270,84 @@ void configureCamera(){
     cv::createTrackbar("MaxS", windowCamera, &maxS, 255);
     cv::createTrackbar("MinV", windowCamera, &minV, 255);
     cv::createTrackbar("MaxV", windowCamera, &maxV, 255);
+    CalibrationRegion region;
+    cv::setMouseCallback(windowCamera, onCalibrationMouse, &region);
 
+    // Margin around the labelled hand that is neither foreground nor background, as a fraction of the size of the frame
+    double labelMargin = 0.05;
+
+    HsvCalibration calibration;
+    Mat frame, labels, mask, display;
+    bool paused = false;
     while (1)
     {
-        // Capture the frame
-        cv::Mat frame;
-        cap >> frame;
-
-        //Process the image
-        int hsvConfigCurrent [6] = {minH, maxH, minS, maxS, minV, maxV};
-        Mat hsv = processImage(frame, hsvConfigCurrent);
+        // Capture the frame, keeping the last one when paused or when the source ended
+        int label = -1;
+        Mat captured;
+        if (!paused && source->read(captured, label) && !captured.empty()) {
+            frame = captured;
+            calibration.setFrame(frame);
+
+            // Label the frame with the region of the hand
+            if (region.changed) {
+                calibration.resetLabels();
+                region.changed = false;
+            }
+            Rect hand = region.region & Rect(0, 0, frame.cols, frame.rows);
+            if (!region.dragging && hand.area() > 0) {
+                int margin = cvRound(labelMargin * max(frame.cols, frame.rows));
+                labels.create(frame.size(), CV_8U);
+                labels.setTo(Scalar(HsvCalibration::BACKGROUND));
+                Rect around = Rect(hand.x - margin, hand.y - margin, hand.width + 2 * margin, hand.height + 2 * margin) & Rect(0, 0, frame.cols, frame.rows);
+                labels(around).setTo(Scalar(128));
+                labels(hand).setTo(Scalar(HsvCalibration::FOREGROUND));
+                calibration.addLabels(labels);
+            }
+        }
 
-        //Show the image in the screen
-        cv::imshow(windowCamera, hsv);
+        //Threshold the cached frame with the current sliders
+        if (calibration.hasFrame()) {
+            int hsvConfigCurrent [6] = {minH, maxH, minS, maxS, minV, maxV};
+            calibration.preview(hsvConfigCurrent, mask);
+
+            //Show the image in the screen, with the labelled region
+            display = Mat::zeros(frame.size(), frame.type());
+            frame.copyTo(display, mask);
+            if (region.region.area() > 0)
+                cv::rectangle(display, region.region, Scalar(0, 255, 0), 2);
+            cv::imshow(windowCamera, display);
+        }
 
         // Print current config
         //cout << "int minH = " << minH << ", maxH = " << maxH << ", minS = "<< minS << ", maxS = " << maxS << ", minV = " << minV << ", maxV = " <<maxV << ";" << endl;
 
-        // If a key is pressed exit the loop
-        if (cv::waitKey(30) >= 0) break;
+        // Keys of the calibration; any other key exits the loop
+        int key = cv::waitKey(frameDelay);
+        if (key < 0)
+            continue;
+        key &= 0xFF;
+        if (key == ' ') {
+            paused = !paused;
+        } else if (key == 'a' || key == 'A') {
+            int fitted [6];
+            if (calibration.fitThresholds(fitted)) {
+                cv::setTrackbarPos("MinH", windowCamera, fitted[0]);
+                cv::setTrackbarPos("MaxH", windowCamera, fitted[1]);
+                cv::setTrackbarPos("MinS", windowCamera, fitted[2]);
+                cv::setTrackbarPos("MaxS", windowCamera, fitted[3]);
+                cv::setTrackbarPos("MinV", windowCamera, fitted[4]);
+                cv::setTrackbarPos("MaxV", windowCamera, fitted[5]);
+                cout << "Automatic thresholds from " << calibration.getForegroundCount() << " pixels of the hand: " << fitted[0] << " " << fitted[1] << " "
+                     << fitted[2] << " " << fitted[3] << " " << fitted[4] << " " << fitted[5] << endl;
+            } else {
+                cout << "Drag a rectangle over the hand first, the automatic mode needs labelled frames" << endl;
+            }
+        } else if (key == 'r' || key == 'R') {
+            calibration.resetLabels();
+            region.region = Rect();
+        } else {
+            break;
+        }
     }
 
     // Close the window when finished
@@ -188,142 +364,186 @@ void configureCamera(){
 
 /**
     Function that loops over the images folder, imports and process the images and divides them into the training and testing sets (~30% for testing)
+    The images are decoded and processed in parallel over all the cores, but the rows keep the same order and the same training/testing split as reading them one by one.
+    The files are read ahead by a prefetcher thread, and the JPEG images are decoded already reduced to the working resolution (see ImageLoader.h).
+    Both sets are views of a single matrix allocated once with the final number of images (the training rows first), and the processed images are
+    stored as 8 bits (their values are 0 or 255), a quarter of the memory of float rows. Use createTrainData where a trainer needs float samples.
     Params:
         trainData - A matrix with the images (one image per row) of the training set
         trainClasses - A matrix of one column and the classes of the training set (according to the trainData images)
         testData - A matrix with the images (one image per row) of the testing set
         testClasses - A matrix of one column and the classes of the testing set (according to the testData images)
-        trainingInData - An object with the training data ready to be used for training a model
+        config - The resolutions used to process the images
 */
-void createData( Mat& trainData, Mat& trainClasses, Mat&testData, Mat& testClasses, Ptr<TrainData>& trainingInData)
+void createData( Mat& trainData, Mat& trainClasses, Mat&testData, Mat& testClasses, const PreprocessConfig& config)
 {
     // Indicates if it should show the images that are being processed or not
     bool showTraining = false;
 
-    // Loop over the images folder to load and processed the images for the dataset
-    DIR *dir;
-    struct dirent *ent;
-    DIR *dirClass;
-    struct dirent *imgFile;
-    if ((dir = opendir ("images\\")) != NULL) {
-      // This is the images folder... now we loop through all files and if it is a dir then we go inside
-      printf ("Dir: %s\n", dir->dd_name);
-      while ((ent = readdir (dir)) != NULL) {
-        // Here we are in the files of the images folders
-        if (strcmp(ent->d_name, ".") != 0 & strcmp(ent->d_name, "..") != 0){
-
-            // Path of the file/folder in the images folder
-            stringstream ss;
-            ss << "images\\" << ent->d_name;
-            string ss2 = ss.str();
-            const char * dirClassPath = ss2.c_str();
-
-            // Static values for perfect threshold of training test images
-            //int minH = 10, maxH = 160, minS = 10, maxS = 200, minV = 10, maxV = 130;
-            int minH = 10, maxH = 160, minS = 0, maxS = 200, minV = 10, maxV = 130;
-
-            //For showing only
-            const char* windowName = "Training Hand Gesture Classifier";
-            if(showTraining){
-                namedWindow(windowName);
-                cv::createTrackbar("MinH", windowName, &minH, 180);
-                cv::createTrackbar("MaxH", windowName, &maxH, 180);
-                cv::createTrackbar("MinS", windowName, &minS, 255);
-                cv::createTrackbar("MaxS", windowName, &maxS, 255);
-                cv::createTrackbar("MinV", windowName, &minV, 255);
-                cv::createTrackbar("MaxV", windowName, &maxV, 255);
-            }
-
-
-            // if it's a folder then go inside and loop for files
-            if ((dirClass = opendir (dirClassPath)) != NULL) {
-                char* classImg = ent->d_name; //This is the class of the image
-                int classImgInt = atoi(classImg);
-
-                // Load the images and divide them between testing and training sets
-                int countTest = 1;
-                while ((imgFile = readdir (dirClass)) != NULL) {
-
-                    // check if the file extension is .jpg or png
-                    bool isImg = imgFile->d_namlen >= 4 && strcmp(imgFile->d_name + imgFile->d_namlen - 4, ".jpg") == 0;
-                    isImg = isImg || imgFile->d_namlen >= 4 && strcmp(imgFile->d_name + imgFile->d_namlen - 4, ".png") == 0;
-                    if (isImg){
-                        // Here we are in the files of the images folders
-                        //cout<< "Class: "<<classImgInt<<"\n";
-                        //printf ("     : %s\n", imgFile->d_name);
-
-                        stringstream sf;
-                        sf << "images\\" << ent->d_name << "\\" << imgFile->d_name;
-                        string sf2 = sf.str();
-                        const char * dirImgPath = sf2.c_str();
-
-                        // Load and preprocess the image
-                        Mat img = imread(dirImgPath);
-
-                        //Process the image
-                        int hsvConfig [6]= {minH, maxH, minS, maxS, minV, maxV};
-                        Mat hsv = processImage(img, hsvConfig);
-
-                        // Show the image if necessary
-                        if(showTraining){
-                            cv::imshow(windowName, hsv);
-                        }
-
-                        // Convert to format for training
-                        Mat floatImg;
-                        hsv.convertTo(floatImg, CV_32F);
-
-                        // Divide in training and testing sets (takes number 3, 5, and 8 of each 10 images ~30%)
-                        // For cross validation take for test 1,2,3, then 4,5,6 and finally 7,8,9,10. Run it 3 times.
-                        if(countTest == 3 || countTest == 5 || countTest == 8){
-                            // ADD to testset
-                            //testData.push_back(floatImg.reshape(1,1) );
-                            testData.push_back(floatImg.reshape(1,1) );
-                            testClasses.push_back(classImgInt);
-                        } else{
-                            // ADD to train
-                            //trainData.push_back(floatImg.reshape(1,1) );
-                            trainData.push_back(floatImg.reshape(1,1) );
-                            trainClasses.push_back(classImgInt);
-                        }
-
-                        // Reset the counter if we got to 10
-                        if(countTest >= 10)
-                            countTest = 1;
-                        else
-                            countTest++;
-
-                        // Make the reading slower if showing the Training
-                        if(showTraining){
-                            if (cv::waitKey(2) >= 0) break;
-                        }
-                    }
-                }
+    // Static values for perfect threshold of training test images
+    const int* hsvConfig = DATASET_HSV_CONFIG;
+
+    // List the images of the dataset and the set each one belongs to
+    vector<DatasetEntry> entries;
+    listDataset(entries);
+
+    // Use the cached processed images if the dataset and the processing parameters didn't change
+    // The processed images are binary (and cached bit-packed) unless it is the legacy preprocessing
+    ScopedTimer createTimer(STAGE_CREATE_DATA);
+    bool packed = !config.isLegacy();
+    vector<Mat> processed(entries.size());
+    FeatureCache cache;
+    bool useCache = cache.open(FEATURE_CACHE_FILE, entries, hsvConfig, config.workWidth, config.featureSize, config.cropsHand(), packed);
+    if (useCache) {
+        cout << "Using the processed images stored in " << FEATURE_CACHE_FILE << endl;
+        if (!packed) {
+            for (size_t i = 0; i < entries.size(); i++)
+                processed[i] = cache.sample((int)i);
+        }
+    } else {
+        // Load and preprocess the images in parallel, each one into its own slot so the order is kept
+        // Every worker takes the files read ahead by the prefetcher and reuses its buffers (file, decoded image and processing) between images
+        ScopedTimer loadTimer(STAGE_LOAD_IMAGES);
+        WorkStealingPool pool;
+        vector<string> paths(entries.size());
+        for (size_t i = 0; i < entries.size(); i++)
+            paths[i] = entries[i].path;
+        ImagePrefetcher prefetcher(paths, 4 * pool.size());
+        pool.parallelFor(0, pool.size(), [&](int) {
+            vector<uchar> bytes;
+            Mat img;
+            PreprocessWorkspace workspace;
+            int i;
+            while (prefetcher.next(i, bytes)) {
+                ScopedTimer readTimer(STAGE_READ_IMAGE);
+                decodeImage(bytes, config.workWidth, img);
+                readTimer.stop();
+                Instrumentation::add(COUNTER_IMAGE_BYTES, (long long)bytes.size());
+                ScopedTimer processTimer(STAGE_PROCESS_IMAGE);
+                processed[i] = processImage(img, hsvConfig, config, workspace).clone();
             }
+        });
+        loadTimer.stop();
+        double seconds = loadTimer.elapsedSeconds();
+        cout << "Processed " << entries.size() << " images in " << seconds << " seconds using " << pool.size() << " threads ("
+             << (seconds > 0 ? entries.size() / seconds : 0) << " images/second, "
+             << (entries.empty() ? 0 : prefetcher.bytesRead() / 1024.0 / entries.size()) << " KB read per image)" << endl;
+
+        // Store the processed images for the next runs
+        if (!FeatureCache::write(FEATURE_CACHE_FILE, entries, hsvConfig, config.workWidth, config.featureSize, config.cropsHand(), packed, processed))
+            cout << "Error writing the processed images cache file" << endl;
+    }
 
-            // If the training was showed, close the window
-            if(showTraining){
-                cvDestroyWindow(windowName);
+    // Count the images of each set to allocate the matrix of both with its final size
+    int numTrain = 0, numTest = 0;
+    vector<int> rowOf(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+        rowOf[i] = entries[i].isTest ? numTest++ : numTrain++;
+    // The raw features are the 8 bits processed images, the rest are computed from them as floats
+    const FeatureExtractor* extractor = getFeatureExtractor(config.features);
+    CV_Assert(extractor != NULL);
+    int numPixels = config.featureSize.area();
+    int numFeatures = extractor->size(config.featureSize);
+    Mat samples((int)entries.size(), numFeatures, extractor->isRaw() ? CV_8U : CV_32F);
+    trainData = samples.rowRange(0, numTrain);
+    testData = samples.rowRange(numTrain, numTrain + numTest);
+    trainClasses.create(numTrain, 1, CV_32S);
+    testClasses.create(numTest, 1, CV_32S);
+
+    // Add the features of the processed images to the training and testing sets in the original order
+    ScopedTimer fillTimer(STAGE_FILL_SETS);
+    parallel_for_(Range(0, (int)entries.size()), [&](const Range& range) {
+        Mat mask(config.featureSize, CV_8U);
+        for (int i = range.start; i < range.end; i++) {
+            Mat& data = entries[i].isTest ? testData : trainData;
+            Mat& classes = entries[i].isTest ? testClasses : trainClasses;
+            Mat row = data.row(rowOf[i]);
+            if (extractor->isRaw()) {
+                if (useCache && packed)
+                    unpackMask(cache.packedSample(i), numPixels, row.ptr<uchar>());
+                else
+                    processed[i].reshape(1,1).copyTo(row);
+            } else {
+                if (useCache && packed)
+                    unpackMask(cache.packedSample(i), numPixels, mask.ptr<uchar>());
+                extractor->compute(useCache && packed ? mask : processed[i], row.ptr<float>());
             }
+            processed[i].release();
+            classes.at<int>(rowOf[i]) = entries[i].classImg;
         }
-
-      }
-      closedir (dir);
-    } else {
-      /* could not open directory */
-      perror ("");
-      //return EXIT_FAILURE;
+    });
+    fillTimer.stop();
+
+    // Show the images if necessary
+    if(showTraining && extractor->isRaw()){
+        const char* windowName = "Training Hand Gesture Classifier";
+        namedWindow(windowName);
+        for (size_t i = 0; i < entries.size(); i++) {
+            Mat row = (entries[i].isTest ? testData : trainData).row(rowOf[i]);
+            cv::imshow(windowName, displayImage(row.reshape(1, config.featureSize.height)));
+            if (cv::waitKey(2) >= 0) break;
+        }
+        cvDestroyWindow(windowName);
     }
+    createTimer.stop();
+    cout << "Training and testing sets ready in " << createTimer.elapsedSeconds() << " seconds" << endl;
 
     // Print some final statistics
     cout<<"trainData size: " << trainData.size() << endl;
     cout<<"trainClasses size: " << trainClasses.size() << endl;
     cout<<"testData size: " << testData.size() << endl;
     cout<<"testClasses size: " << testClasses.size() << endl;
+    cout<<"Peak memory: " << Instrumentation::peakResidentBytes() / (1024.0 * 1024.0) << " MB" << endl;
 
-    // Create the object of the Train data so the model can use it.
-    trainingInData=TrainData::create(trainData, ROW_SAMPLE, trainClasses);
+}
+
+/**
+    Function that creates the object of the Train data used by SVM::train, that needs float samples.
+    The 8 bits samples are converted here, only when a model is trained with SVM::train.
+    Params:
+        data - A matrix with the samples (one per row, 8 bits or float)
+        classes - A matrix of one column with the classes of the samples
+    Returns: the object of the Train data.
+*/
+Ptr<TrainData> createTrainData(const Mat& data, const Mat& classes){
+    Mat floatData = data;
+    if (data.type() != CV_32F)
+        data.convertTo(floatData, CV_32F);
+    return TrainData::create(floatData, ROW_SAMPLE, classes);
+}
+
+/**
+    Function that stores a model in HandNumbersClassifier_01.dat and, if it is linear, in its binary bundle.
+    The bundle of a previous model is removed when the new one can't be bundled, so the prediction modes never load an outdated model.
+    Params:
+        model - The model to store
+*/
+void storeModel(const HandModel& model){
+    saveModel(model, "HandNumbersClassifier_01.dat");
+    cout << "SVM Model stored in file: HandNumbersClassifier_01.dat" << endl;
+    if (saveModelBundle(model, MODEL_BUNDLE_FILE))
+        cout << "Model bundle stored in file: " << MODEL_BUNDLE_FILE << endl;
+    else
+        remove(MODEL_BUNDLE_FILE);
+}
 
+/**
+    Function that loads the model of the prediction modes: the binary bundle if there is one (it is mapped, not parsed),
+    HandNumbersClassifier_01.dat otherwise.
+    Params:
+        model - The loaded model
+    Returns: true if the model could be loaded.
+*/
+bool loadPredictionModel(HandModel& model){
+    int64 startTicks = getTickCount();
+    bool bundled = loadModelBundle(MODEL_BUNDLE_FILE, model);
+    if (!bundled && !loadModel("HandNumbersClassifier_01.dat", model)) {
+        cout << "Error loading the SVM model file: HandNumbersClassifier_01.dat" << endl;
+        return false;
+    }
+    cout << "Model loaded from " << (bundled ? MODEL_BUNDLE_FILE : "HandNumbersClassifier_01.dat") << " in "
+         << (getTickCount() - startTicks) * 1000.0 / getTickFrequency() << " ms" << endl;
+    return true;
 }
 
 /**
@@ -339,225 +559,1041 @@ void trainSVM(){
     Mat trainClasses;
     Mat testData;
     Mat testClasses;
-    Ptr<TrainData> trainingInData;
-
-    cout << "Reading and preprocessing training and testing images" << endl;
-    createData(trainData, trainClasses, testData, testClasses, trainingInData);
 
     // Variable to check if the model should be trained... if false it only loads the model and predicts the testing set.
     bool activedTraining = false;
 
+    // Variable to train linear models with the multithreaded trainer (one-vs-one pairs in parallel) instead of SVM::train
+    bool parallelLinearTraining = true;
+
+    // Name of the feature extractor of a new model: raw (the pixels), hog, moments or contour (see compareFeatureExtractors)
+    string featureExtractor = "raw";
+
+    // Fraction of the variance of the features kept by the PCA projection of a new model, or 0 to train the SVM over the features themselves
+    double retainedVariance = 0.95;
+
+    // Variable to crop the hand of the images (normalized to a 64x64 image) instead of resizing the whole image
+    bool cropHand = true;
+
+    // The model stores the preprocessing it was trained with, a new model uses the default one
+    HandModel model;
+    if (cropHand)
+        model.preprocessing = PreprocessConfig::cropped();
+    model.preprocessing.features = featureExtractor;
+    if (!activedTraining) {
+        // Load the model from the file
+        if (!loadModel("HandNumbersClassifier_01.dat", model)) {
+            cout << "Error loading the SVM model file: HandNumbersClassifier_01.dat" << endl;
+            return;
+        }
+    }
+
+    cout << "Reading and preprocessing training and testing images" << endl;
+    createData(trainData, trainClasses, testData, testClasses, model.preprocessing);
+
     //Create the SVM Model
     cout << "Creating SVM Model" << endl;
     cout<<"Elements in Training Set: "<< trainData.rows << endl;
 
-    Ptr<SVM> svm;
+    Ptr<SVM> svm = model.svm;
 
     if (activedTraining) {
-        // Set the parameters of the SVM Model
-        svm = SVM::create();
-        svm->setType(SVM::C_SVC);  //C_SVC
-        svm->setC(2.67);
-        svm->setGamma(5.383);
-        svm->setKernel(SVM::LINEAR);  //SVM::LINEAR
-        svm->setTermCriteria(TermCriteria(TermCriteria::MAX_ITER, (int)1e7, 1e-6));
-
-        // Clock for measuring the time
-        Clock C;
-        C.start();
+        // Set the parameters of the SVM Model (C_SVC, LINEAR, C = 2.67; the best ones can be found with searchSVM)
+        SvmParams params;
+        svm = params.createSvm();
+
+        // Timer for measuring the time
+        ScopedTimer trainTimer(STAGE_TRAIN);
+
+        // Fit the projection over the training set, the SVM is trained over the projected samples
+        Mat svmTrainData = trainData;
+        if (retainedVariance > 0) {
+            ScopedTimer projectionTimer(STAGE_FIT_PROJECTION);
+            if (model.projection.fit(trainData, retainedVariance)) {
+                model.projection.projectRows(trainData, svmTrainData);
+                cout << "Projection: " << model.projection.getComponentCount() << " components of " << trainData.cols << " features" << endl;
+            }
+        }
 
         // Train the SVM Model
         cout << "Starting training process" << endl;
-        svm->train(trainingInData);  //In this case we use Ptr<TrainData>
+        if (parallelLinearTraining && params.kernel == SVM::LINEAR) {
+            LinearTrainStats stats;
+            svm = trainLinearSvm(svmTrainData, trainClasses, params, stats);
+            cout << "Decision functions converged: " << stats.convergedPairs << " of " << stats.pairs << endl;
+        } else {
+            svm->train(createTrainData(svmTrainData, trainClasses));  //In this case we use Ptr<TrainData>
+        }
         cout << "Finished training process" << endl;
 
         // Write the model into a file
         cout << "Writing SVM model's file" << endl;
-        svm->save("HandNumbersClassifier_01.dat");
-        cout << "SVM Model stored in file: HandNumbersClassifier_01.dat" << endl;
+        model.svm = svm;
+        setModelClasses(model, trainClasses);
+        storeModel(model);
 
-        C.end();
-        cout<<"Elapsed time: " << (C.elapsedTime() / 1000) << " seconds" << endl;
-    } else {
-        // Load the model from the file
-        svm = StatModel::load<SVM>("HandNumbersClassifier_01.dat");
+        trainTimer.stop();
+        cout<<"Elapsed time: " << trainTimer.elapsedSeconds() << " seconds" << endl;
+        cout<<"Peak memory: " << Instrumentation::peakResidentBytes() / (1024.0 * 1024.0) << " MB" << endl;
     }
 
+    // Variable to print the prediction of every image of the sets
+    bool printPredictions = false;
+
     // Predict the training set
-    cout<<"Predicting over the Test Set." << endl;
+    cout<<"Predicting over the Training Set." << endl;
     cout<<"Elements in Training Set: "<< trainData.rows << endl;
-    int correctTrain =0;
-    for (int k=0; k<trainData.rows; k++)
-    {
-        // Predict the current image of the test set
-        Mat tmp = trainData.row(k)+0;   //+0 explanation see row() operator in OpenCV manual
-        Mat out1;
-        float response = svm->predict(tmp);
+    EvaluationResult trainResult = evaluateModel(model, trainData, trainClasses, "TrainSet", printPredictions);
+
+    // Predict the test set
+    cout<<"Predicting over the Test Set." << endl;
+    cout<<"Elements in Test Set: "<< testData.rows << endl;
+    EvaluationResult testResult = evaluateModel(model, testData, testClasses, "TestSet", printPredictions);
 
-        // Print the result of the current prediction
-        cout<<"TrainSet[" << k << "] - True: " << int(trainClasses.at<int32_t>(0,k)) << " | Predicted: " << response << endl;
+    // Print final statistics
+    trainResult.print(cout, "Train Set");
+    testResult.print(cout, "Test Set");
+
+    // Check the linear scorer used for the predictions against the SVM over the test set
+    if (!model.scorer.empty()) {
+        int differentLabels = 0;
+        double svmMs = 0, scorerMs = 0;
+        Mat floatRow;
+        for (int k=0; k<testData.rows; k++)
+        {
+            if (!model.projection.empty())
+                model.projection.projectRows(testData.row(k), floatRow);
+            else
+                testData.row(k).convertTo(floatRow, CV_32F);
+            int64 startTicks = getTickCount();
+            float response = svm->predict(floatRow);
+            svmMs += (getTickCount() - startTicks) * 1000.0 / getTickFrequency();
+
+            startTicks = getTickCount();
+            int scorerResponse = model.scorer.predict(testData.row(k));
+            scorerMs += (getTickCount() - startTicks) * 1000.0 / getTickFrequency();
+
+            if ((int)response != scorerResponse)
+                differentLabels++;
+        }
+        cout << " Linear scorer" << endl;
+        cout << " Predictions different from the SVM: " << differentLabels << endl;
+        cout << " Time per prediction: " << scorerMs / max(1, testData.rows) << " ms (SVM: " << svmMs / max(1, testData.rows) << " ms)" << endl;
+    }
 
-        // Increment number of corrects if correct
-        if ( (int32_t)(response) ==  trainClasses.at<int32_t>(0,k))
-            correctTrain++;
+    // Check the bit-packed scorer (quantized weights) against the linear scorer over the test set
+    if (!model.packedScorer.empty()) {
+        int differentLabels = 0;
+        double packedMs = 0;
+        vector<uint64_t> packedRow(packedWords(testData.cols));
+        for (int k=0; k<testData.rows; k++)
+        {
+            packMask(testData.ptr<uchar>(k), testData.cols, &packedRow[0]);
+            int64 startTicks = getTickCount();
+            int packedResponse = model.packedScorer.predict(&packedRow[0]);
+            packedMs += (getTickCount() - startTicks) * 1000.0 / getTickFrequency();
 
+            if (packedResponse != model.scorer.predict(testData.ptr<uchar>(k)))
+                differentLabels++;
+        }
+        cout << " Bit-packed scorer" << endl;
+        cout << " Predictions different from the linear scorer: " << differentLabels << endl;
+        cout << " Time per prediction: " << packedMs / max(1, testData.rows) << " ms" << endl;
     }
 
-    // Predict the test set
-    cout<<"Predicting over the Test Set." << endl;
-    cout<<"Elements in Test Set: "<< testData.rows << endl;
-    int correctTest =0;
-    for (int k=0; k<testData.rows; k++)
-    {
-        // Predict the current image of the test set
-        Mat tmp = testData.row(k)+0;   //+0 explanation see row() operator in OpenCV manual
-        Mat out1;
-        float response = svm->predict(tmp);
+    writeProfile();
+}
+
+/**
+    Function that compares the multithreaded linear trainer with SVM::train over the same training set.
+    It prints the wall-clock time of both, the speedup, their accuracies over the training and testing sets and how many test predictions differ.
+    No model is stored.
+    Params:
+        numThreads - Number of threads of the linear trainer, one per core if it is 0
+*/
+void compareLinearTrainers(int numThreads){
+
+    // Read and create training and testing sets
+    Mat trainData;
+    Mat trainClasses;
+    Mat testData;
+    Mat testClasses;
+    HandModel opencvModel;
+    cout << "Reading and preprocessing training and testing images" << endl;
+    createData(trainData, trainClasses, testData, testClasses, opencvModel.preprocessing);
+    HandModel linearModel = opencvModel;
+    SvmParams params;
+
+    // Train with SVM::train (SMO, single threaded)
+    cout << "Training with SVM::train: " << params.name() << endl;
+    ScopedTimer opencvTimer(STAGE_TRAIN);
+    opencvModel.svm = params.createSvm();
+    opencvModel.svm->train(createTrainData(trainData, trainClasses));
+    opencvTimer.stop();
+    setModelClasses(opencvModel, trainClasses);
+
+    // Train with dual coordinate descent, the decision functions in parallel
+    cout << "Training with the linear trainer: " << params.name() << endl;
+    LinearTrainStats stats;
+    ScopedTimer linearTimer(STAGE_TRAIN_LINEAR);
+    linearModel.svm = trainLinearSvm(trainData, trainClasses, params, stats, numThreads);
+    linearTimer.stop();
+    if (linearModel.svm.empty()) {
+        cout << "Error training the linear model" << endl;
+        return;
+    }
+    setModelClasses(linearModel, trainClasses);
+
+    EvaluationResult opencvTrain = evaluateModel(opencvModel, trainData, trainClasses, "TrainSet");
+    EvaluationResult opencvTest = evaluateModel(opencvModel, testData, testClasses, "TestSet");
+    EvaluationResult linearTrain = evaluateModel(linearModel, trainData, trainClasses, "TrainSet");
+    EvaluationResult linearTest = evaluateModel(linearModel, testData, testClasses, "TestSet");
+    int differentLabels = 0;
+    for (size_t k = 0; k < opencvTest.predictions.size(); k++)
+        if (opencvTest.predictions[k] != linearTest.predictions[k])
+            differentLabels++;
+
+    cout << endl << " Trainer\tTime (s)\tTrain accuracy\tTest accuracy\tSupport vectors" << endl;
+    cout << " SVM::train\t" << opencvTimer.elapsedSeconds() << "\t" << opencvTrain.accuracy() << "\t" << opencvTest.accuracy() << "\t"
+         << opencvModel.svm->getSupportVectors().rows << endl;
+    cout << " Linear (" << stats.threads << " threads)\t" << linearTimer.elapsedSeconds() << "\t" << linearTrain.accuracy() << "\t"
+         << linearTest.accuracy() << "\t" << linearModel.svm->getSupportVectors().rows << endl;
+    cout << " Speedup: " << opencvTimer.elapsedSeconds() / max(1e-9, linearTimer.elapsedSeconds()) << "x" << endl;
+    cout << " Decision functions converged: " << stats.convergedPairs << " of " << stats.pairs << " (at most " << stats.maxIterations << " passes)" << endl;
+    cout << " Test predictions different from SVM::train: " << differentLabels << " of " << testData.rows << endl;
+
+    writeProfile();
+}
 
-        // Print the result of the current prediction
-        cout<<"TestSet[" << k << "] - True: " << int(testClasses.at<int32_t>(0,k)) << " | Predicted: " << response << endl;
+/**
+    Function that trains a linear SVM model streaming the dataset in mini-batches, and stores it in a file.
+    Only one batch of processed images is in memory at a time (read from the feature cache if it is valid, otherwise decoded and processed),
+    so the memory doesn't grow with the number of images. The testing set is also predicted batch by batch.
+    Params:
+        warmStart - If the training starts from the stored model instead of from zero
+        batchSize - Number of images of each batch
+        epochs - Number of passes over the training images
+*/
+void trainStreaming(bool warmStart, int batchSize, int epochs){
 
-        // Increment number of corrects if correct
-        if ( (int32_t)(response) ==  testClasses.at<int32_t>(0,k))
-            correctTest++;
+    // The preprocessing of the stored model is kept when it is updated
+    HandModel model;
+    if (warmStart && !loadModel("HandNumbersClassifier_01.dat", model)) {
+        cout << "Error loading the SVM model file: HandNumbersClassifier_01.dat" << endl;
+        return;
+    }
+    const int* hsvConfig = DATASET_HSV_CONFIG;
+    int numVars = model.preprocessing.featureSize.area();
+    if (!modelFeatures(model)->isRaw()) {
+        cout << "The streaming training only supports the raw features, the stored model uses: " << model.preprocessing.features << endl;
+        return;
+    }
 
+    // List the images and use the processed ones of the cache if it is valid (it is not written here, that needs every image in memory)
+    vector<DatasetEntry> entries;
+    listDataset(entries);
+    FeatureCache cache;
+    bool useCache = cache.open(FEATURE_CACHE_FILE, entries, hsvConfig, model.preprocessing.workWidth, model.preprocessing.featureSize,
+                               model.preprocessing.cropsHand(), !model.preprocessing.isLegacy());
+    if (useCache)
+        cout << "Using the processed images stored in " << FEATURE_CACHE_FILE << endl;
+    DatasetBatchReader reader(entries, hsvConfig, model.preprocessing, useCache ? &cache : NULL);
+
+    vector<int> trainIdx, testIdx;
+    vector<int> labels;
+    for (size_t i = 0; i < entries.size(); i++) {
+        (entries[i].isTest ? testIdx : trainIdx).push_back((int)i);
+        labels.push_back(entries[i].classImg);
+    }
+    sort(labels.begin(), labels.end());
+    labels.erase(unique(labels.begin(), labels.end()), labels.end());
+    if (trainIdx.empty() || labels.size() < 2) {
+        cout << "There are not enough training images" << endl;
+        return;
     }
 
-    // Print final statistics
-    cout << " Train Set Prediction" << endl;
-    cout << " Number of correct matches: " << correctTrain << endl;
-    cout << " Accuracy: " << (correctTrain * 100.0 / double(trainData.rows)) << endl;
+    // Start the learner, from the stored weights if it is a warm start (its steps continue as if it had seen one pass of the current images)
+    SvmParams params;
+    OnlineLinearSvm learner;
+    learner.create(labels, numVars, params.C, (int)trainIdx.size());
+    if (warmStart) {
+        if (!learner.warmStart(model, (long long)trainIdx.size() * 2 / (long long)labels.size())) {
+            cout << "The stored model is not linear or has other classes or features, it can't be updated" << endl;
+            return;
+        }
+        cout << "Updating the stored model" << endl;
+    }
+
+    WorkStealingPool pool;
+    Mat batch;
+    vector<int> batchClasses;
+    vector<bool> valid;
+    RNG rng(getTickCount());
+    ScopedTimer trainTimer(STAGE_TRAIN);
+    for (int epoch = 0; epoch < epochs; epoch++) {
+        // The images of the dataset are listed by class, they are shuffled so every batch mixes them
+        for (int k = (int)trainIdx.size() - 1; k > 0; k--)
+            swap(trainIdx[k], trainIdx[rng.uniform(0, k + 1)]);
+        for (size_t first = 0; first < trainIdx.size(); first += batchSize) {
+            vector<int> indices(trainIdx.begin() + first, trainIdx.begin() + min(trainIdx.size(), first + batchSize));
+            ScopedTimer readTimer(STAGE_READ_BATCH);
+            reader.read(indices, pool, batch, batchClasses, valid);
+            readTimer.stop();
+            ScopedTimer updateTimer(STAGE_TRAIN_BATCH);
+            learner.partialFit(batch, batchClasses, valid, pool);
+        }
+        cout << "Epoch " << epoch + 1 << " of " << epochs << " finished" << endl;
+    }
+    trainTimer.stop();
 
-    cout << " Test Set Prediction" << endl;
-    cout << " Number of correct matches: " << correctTest << endl;
-    cout << " Accuracy: " << (correctTest * 100.0 / double(testData.rows)) << endl;
+    model.svm = learner.createSvm(params);
+    if (model.svm.empty()) {
+        cout << "Error creating the SVM model" << endl;
+        return;
+    }
+    model.classLabels = labels;
+    createModelScorers(model);
+    cout << "Trained " << trainIdx.size() << " images in " << trainTimer.elapsedSeconds() << " seconds" << endl;
+    cout << "Memory of the training: " << (batch.total() + learner.memoryBytes()) / (1024.0 * 1024.0) << " MB (batch of "
+         << batchSize << " images and the weights)" << endl;
+
+    // Predict the testing set batch by batch
+    vector<int> trueClasses, predictions;
+    int64 startTicks = getTickCount();
+    for (size_t first = 0; first < testIdx.size(); first += batchSize) {
+        vector<int> indices(testIdx.begin() + first, testIdx.begin() + min(testIdx.size(), first + batchSize));
+        reader.read(indices, pool, batch, batchClasses, valid);
+        for (int k = 0; k < batch.rows; k++) {
+            if (!valid[k])
+                continue;
+            trueClasses.push_back(batchClasses[k]);
+            predictions.push_back(model.scorer.predict(batch.ptr<uchar>(k)));
+        }
+    }
+    double seconds = (getTickCount() - startTicks) / getTickFrequency();
+    summarizePredictions(model.classLabels, trueClasses, predictions, seconds, "TestSet", false).print(cout, "Test Set");
 
+    storeModel(model);
+    writeProfile();
 }
 
 /**
-    Function that starts the camera and predicts the class of the current input of the camera using the SVM model.
+    Function that converts HandNumbersClassifier_01.dat into the binary bundle and compares the time to load each of them and
+    the predictions of both models over the testing images of the feature cache (if it is valid).
+*/
+void convertModel(){
+    HandModel model;
+    int64 startTicks = getTickCount();
+    if (!loadModel("HandNumbersClassifier_01.dat", model)) {
+        cout << "Error loading the SVM model file: HandNumbersClassifier_01.dat" << endl;
+        return;
+    }
+    double parseMs = (getTickCount() - startTicks) * 1000.0 / getTickFrequency();
+    if (!saveModelBundle(model, MODEL_BUNDLE_FILE)) {
+        cout << "The model can't be bundled: only linear models are supported" << endl;
+        return;
+    }
+
+    HandModel bundled;
+    startTicks = getTickCount();
+    if (!loadModelBundle(MODEL_BUNDLE_FILE, bundled)) {
+        cout << "Error loading the model bundle: " << MODEL_BUNDLE_FILE << endl;
+        return;
+    }
+    double mapMs = (getTickCount() - startTicks) * 1000.0 / getTickFrequency();
+    cout << "Model bundle stored in file: " << MODEL_BUNDLE_FILE << endl;
+    cout << "Load time: " << parseMs << " ms (HandNumbersClassifier_01.dat), " << mapMs << " ms (" << MODEL_BUNDLE_FILE << ")" << endl;
+
+    // Both models have to predict the same classes
+    vector<DatasetEntry> entries;
+    listDataset(entries);
+    FeatureCache cache;
+    if (!modelFeatures(model)->isRaw() || model.preprocessing.isLegacy()
+            || !cache.open(FEATURE_CACHE_FILE, entries, DATASET_HSV_CONFIG, model.preprocessing.workWidth, model.preprocessing.featureSize,
+                           model.preprocessing.cropsHand(), true))
+        return;
+    int numVars = model.preprocessing.featureSize.area();
+    vector<uchar> sample(numVars);
+    int compared = 0, different = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!entries[i].isTest)
+            continue;
+        unpackMask(cache.packedSample((int)i), numVars, &sample[0]);
+        compared++;
+        if (model.scorer.predict(&sample[0]) != bundled.scorer.predict(&sample[0]))
+            different++;
+    }
+    cout << "Predictions different from HandNumbersClassifier_01.dat: " << different << " of " << compared << " testing images" << endl;
+}
+
+/**
+    Function that compares the feature extractors: for each one it trains a linear model with the multithreaded trainer over the same images,
+    and prints its number of features, the training time, the accuracy over the training and testing sets and the time per frame
+    (computing the features of a processed image and predicting it). No model is stored.
+*/
+void compareFeatureExtractors(){
+
+    // Processed images of a sample of the testing set, to measure the time per frame
+    vector<DatasetEntry> entries;
+    listDataset(entries);
+    vector<Mat> images;
+    for (size_t i = 0; i < entries.size() && images.size() < 100; i++)
+        if (entries[i].isTest)
+            images.push_back(imread(entries[i].path));
+
+    vector<string> names = featureExtractorNames();
+    stringstream table;
+    table << " Features\tSize\tTrain (s)\tTrain accuracy\tTest accuracy\tPer frame (ms)" << endl;
+    for (size_t n = 0; n < names.size(); n++) {
+        cout << "Features: " << names[n] << endl;
+        Mat trainData;
+        Mat trainClasses;
+        Mat testData;
+        Mat testClasses;
+        HandModel model;
+        model.preprocessing.features = names[n];
+        createData(trainData, trainClasses, testData, testClasses, model.preprocessing);
+
+        LinearTrainStats stats;
+        model.svm = trainLinearSvm(trainData, trainClasses, SvmParams(), stats);
+        if (model.svm.empty()) {
+            cout << "Error training the model" << endl;
+            continue;
+        }
+        setModelClasses(model, trainClasses);
+        EvaluationResult trainResult = evaluateModel(model, trainData, trainClasses, "TrainSet");
+        EvaluationResult testResult = evaluateModel(model, testData, testClasses, "TestSet");
+
+        vector<Mat> processed;
+        for (size_t i = 0; i < images.size(); i++)
+            processed.push_back(processImage(images[i], DATASET_HSV_CONFIG, model.preprocessing));
+        int64 startTicks = getTickCount();
+        for (size_t i = 0; i < processed.size(); i++)
+            predictProcessed(model, processed[i]);
+        double frameMs = (getTickCount() - startTicks) * 1000.0 / getTickFrequency() / max((size_t)1, processed.size());
+
+        table << " " << names[n] << "\t" << trainData.cols << "\t" << stats.seconds << "\t" << trainResult.accuracy() << "\t"
+              << testResult.accuracy() << "\t" << frameMs << endl;
+    }
+    cout << endl << table.str();
+}
+
+/**
+    Structure with a frame of the camera as it goes through the stages of the prediction pipeline.
+*/
+struct PipelineFrame {
+    Mat frame;          // Original frame of the camera
+    Mat processed;      // Processed image
+    float response;     // Predicted class
+    int64_t captureNs;  // Time the frame was captured (Instrumentation::now)
+    int label;          // True class of the frame, or -1 if it is not known
+    bool last;          // Marks the end of the source, it has no frame
+    bool reused;        // The frame didn't change, it gets the last prediction and processed image
+    bool skipped;       // The frame arrived in the cooldown of a prediction, it is not classified
+
+    PipelineFrame() : response(0), captureNs(0), label(-1), last(false), reused(false), skipped(false) {}
+};
+
+/**
+    Function that passes a frame to the next stage of the pipeline.
+    With the drop-oldest policy it never waits: if the next stage is full the frame is dropped. Otherwise (and for the end of the source) it waits until there is space.
+    Params:
+        ring - The ring of the next stage
+        item - The frame
+        dropOldest - If the pipeline drops frames to work on the freshest one
+        stop - Flag that indicates the pipeline is stopping
+    Returns: true if the frame was passed.
+*/
+bool passFrame(SpscRing<PipelineFrame>& ring, PipelineFrame& item, bool dropOldest, const std::atomic<bool>& stop){
+    while (!ring.push(item)) {
+        if ((dropOldest && !item.last) || stop) {
+            Instrumentation::add(COUNTER_DROPPED_FRAMES);
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+/**
+    Function that waits for the next frame of a stage of the pipeline.
+    With the drop-oldest policy it takes the newest frame waiting and drops the older ones.
+    Params:
+        ring - The ring of the stage
+        item - The frame
+        dropOldest - If the pipeline drops frames to work on the freshest one
+        stop - Flag that indicates the pipeline is stopping
+    Returns: true if there is a frame, false if the pipeline stopped.
+*/
+bool takeFrame(SpscRing<PipelineFrame>& ring, PipelineFrame& item, bool dropOldest, const std::atomic<bool>& stop){
+    while (!stop) {
+        int dropped = 0;
+        bool taken = dropOldest ? ring.popLatest(item, dropped) : ring.pop(item);
+        if (dropped > 0)
+            Instrumentation::add(COUNTER_DROPPED_FRAMES, dropped);
+        if (taken)
+            return true;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return false;
+}
+
+/**
+    Function that searches the best parameters of the SVM model with k-fold cross-validation over the training set, and stores the best model in a file.
+    The images are processed once (or read from the cache) and the folds are index views over the training set.
+    The best parameters are trained again with the whole training set and the model is checked with the testing set before it is stored.
+    Params:
+        k - Number of folds
+        randomCount - Number of random parameters to try, or 0 to try the whole grid
+*/
+void searchSVM(int k, int randomCount){
+
+    // Read and create training and testing sets
+    Mat trainData;
+    Mat trainClasses;
+    Mat testData;
+    Mat testClasses;
+    HandModel model;
+    cout << "Reading and preprocessing training and testing images" << endl;
+    createData(trainData, trainClasses, testData, testClasses, model.preprocessing);
+
+    // Cross-validate every set of parameters
+    vector<SvmParams> params = randomCount > 0 ? randomSearchParams(trainData.cols, randomCount) : gridSearchParams(trainData.cols);
+    cout << "Cross-validating " << params.size() << " sets of parameters with " << k << " folds" << endl;
+    int64 startTicks = getTickCount();
+    vector<CrossValidationResult> results = crossValidate(trainData, trainClasses, params, k, model.preprocessing);
+    cout << "Cross-validation finished in " << (getTickCount() - startTicks) / getTickFrequency() << " seconds" << endl;
+    printCrossValidation(cout, results);
+
+    // Train the best parameters with the whole training set and check them with the testing set
+    cout << "Training the best parameters: " << results[0].params.name() << endl;
+    model.svm = results[0].params.createSvm();
+    model.svm->train(createTrainData(trainData, trainClasses));
+    setModelClasses(model, trainClasses);
+    EvaluationResult testResult = evaluateModel(model, testData, testClasses, "TestSet");
+    testResult.print(cout, "Test Set");
+
+    storeModel(model);
+}
+
+/**
+    Function that starts the camera (or another source of frames) and predicts the class of the current input of the camera using the SVM model.
     It reads the SVN Configuration from the config file and displays the predictions to the user, while typing them on the console.
+    The frames go through a pipeline of threads (capture, processing and prediction) connected by lock-free rings, and this thread only displays the results,
+    so each stage runs at its own speed. The time from the capture of a frame to its prediction is measured by the instrumentation.
+    Video files and folders of images are replayed at their frame rate, every frame in order, and when the frames have a true class the predictions are checked.
+    Params:
+        source - The source of the frames, the camera if it is empty
+        maxSpeed - If the frames are replayed as fast as possible, without windows, to measure the throughput of the prediction
 */
-void readCameraAndPredict(){
+void readCameraAndPredict(Ptr<FrameSource> source = Ptr<FrameSource>(), bool maxSpeed = false){
 
     // Load SVM Model
     cout << "Loading SVM Model" << endl;
-    Ptr<SVM> svm;
-    svm = StatModel::load<SVM>("HandNumbersClassifier_01.dat");
-    cout << "SVM Model Loaded, Launching Camera" << endl;
+    HandModel model;
+    if (!loadPredictionModel(model))
+        return;
+    cout << "SVM Model Loaded" << (model.scorer.empty() ? "" : " (linear scorer)") << ", Launching Camera" << endl;
+
+    // Open the source of the frames; only the camera can't be replayed as fast as possible
+    if (source.empty())
+        source = openFrameSource("camera");
+    if (!source->isOpened()) {
+        cout << "Error opening the source of frames: " << source->name() << endl;
+        return;
+    }
+    source->setWorkWidth(model.preprocessing.workWidth);
+    bool isReplay = source->fps() > 0;
+    maxSpeed = maxSpeed && isReplay;
+    bool showWindows = !maxSpeed;
+    cout << "Predicting the frames of " << source->name() << (maxSpeed ? " as fast as possible" : "") << endl;
+
+    // Variable to score the bit-packed frames with the 8 bits quantized weights (faster on low-end CPUs, only for binary processed images)
+    bool packedInference = false;
+    packedInference = packedInference && !model.packedScorer.empty();
+
+    // Variables of the pipeline: if the stages drop the older frames to always work on the freshest one (otherwise every frame is processed in order),
+    // and how many frames can wait between two stages
+    bool dropOldest = true;
+    int queueCapacity = 4;
+
+    // The replayed frames are all predicted, so the results can be reproduced
+    if (isReplay)
+        dropOldest = false;
+
+    // Variable to reuse the last prediction while the scene doesn't change (see ChangeGate), and end of the cooldown of the last prediction
+    bool changeGate = true;
+    std::atomic<int64_t> cooldownEndNs(0);
+
+    // Images shown for each prediction
+    vector<Mat> imgNumbers;
+    for (int i = 0; i <= 5; i++) {
+        stringstream path;
+        path << "support_images//" << i << ".png";
+        imgNumbers.push_back(imread(path.str()));
+    }
 
     // Window for showing the predictions
     const char* windowPred = "Hand Gesture Prediction";
-    namedWindow(windowPred);
-    Mat imgPred = imread("support_images//0.png");
-    imshow(windowPred, imgPred);
-    moveWindow(windowPred, 1000, 600);
-
-    // Windows for processed and original images
     const char* windowOriginal = "Hand Numbers Classifier: Original Image";
-    imshow(windowOriginal, imgPred);
-    moveWindow(windowOriginal, 550, 0);
-
     const char* windowProcessed = "Hand Numbers Classifier: Processed Image";
-    imshow(windowProcessed, imgPred);
-    moveWindow(windowProcessed, 1200, 0);
+    Mat imgPred = imgNumbers[0];
+    if (showWindows) {
+        namedWindow(windowPred);
+        imshow(windowPred, imgPred);
+        moveWindow(windowPred, 1000, 600);
+
+        // Windows for processed and original images
+        imshow(windowOriginal, imgPred);
+        moveWindow(windowOriginal, 550, 0);
+
+        imshow(windowProcessed, imgPred);
+        moveWindow(windowProcessed, 1200, 0);
+    }
 
-    // Read the HSV configuration
+    // Read the HSV configuration (the images of the dataset use the threshold of the training)
     //int minH = 130, maxH = 160, minS = 10, maxS = 40, minV = 75, maxV = 130;
-    int* hsvConfig = readHsvConfigFile();
-    int minH = hsvConfig[0], maxH = hsvConfig[1], minS = hsvConfig[2], maxS = hsvConfig[3], minV = hsvConfig[4], maxV = hsvConfig[5];
+    int hsvConfig [6];
+    loadHsvConfig(hsvConfig, source->usesDatasetThreshold());
+
+    // Rings between the stages and flag to stop them
+    SpscRing<PipelineFrame> capturedFrames(queueCapacity);
+    SpscRing<PipelineFrame> processedFrames(queueCapacity);
+    SpscRing<PipelineFrame> predictedFrames(queueCapacity);
+    std::atomic<bool> stop(false);
+
+    // Capture stage, the replayed frames are paced at the frame rate of the source unless it runs at maximum speed
+    int64_t runStart = Instrumentation::now();
+    std::thread captureThread([&]() {
+        int64_t frameIndex = 0;
+        while (!stop) {
+            PipelineFrame item;
+            if (isReplay && !maxSpeed)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(runStart + (int64_t)(frameIndex * 1e9 / source->fps()) - Instrumentation::now()));
+            ScopedTimer captureTimer(STAGE_CAPTURE);
+            bool hasFrame = source->read(item.frame, item.label);
+            captureTimer.stop();
+            if (!hasFrame && isReplay) {
+                // End of the replayed frames
+                item.last = true;
+                passFrame(capturedFrames, item, dropOldest, stop);
+                break;
+            }
+            if (!hasFrame || item.frame.empty()) {
+                // The camera didn't give a frame, try again
+                Instrumentation::add(COUNTER_DROPPED_FRAMES);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            item.captureNs = Instrumentation::now();
+            Instrumentation::add(COUNTER_FRAMES);
+            frameIndex++;
+            passFrame(capturedFrames, item, dropOldest, stop);
+        }
+    });
+
+    // Processing stage
+    std::thread processThread([&]() {
+        PipelineFrame item;
+        // The frames are processed in order, so the hand is tracked between them
+        PreprocessWorkspace workspace;
+        workspace.trackHand = true;
+        ChangeGate gate;
+        Mat lastProcessed;
+        while (takeFrame(capturedFrames, item, dropOldest, stop)) {
+            if (item.last) {
+                passFrame(processedFrames, item, dropOldest, stop);
+                break;
+            }
 
-    // Launch and start reading from camera
-    cv::VideoCapture cap(0);
+            // No work in the cooldown, and none for frames where the scene didn't change
+            if (item.captureNs < cooldownEndNs) {
+                item.skipped = true;
+                gate.reset();
+                Instrumentation::add(COUNTER_COOLDOWN_FRAMES);
+            } else if (changeGate && !lastProcessed.empty() && !gate.changed(item.frame, hsvConfig)) {
+                item.reused = true;
+                Instrumentation::add(COUNTER_UNCHANGED_FRAMES);
+            }
+            if (item.skipped || item.reused) {
+                item.processed = lastProcessed;
+                passFrame(processedFrames, item, dropOldest, stop);
+                continue;
+            }
 
+            ScopedTimer processTimer(STAGE_PROCESS_FRAME);
+            item.processed = processImage(item.frame, hsvConfig, model.preprocessing, workspace).clone();
+            processTimer.stop();
+            lastProcessed = item.processed;
+            Instrumentation::add(COUNTER_EVALUATED_FRAMES);
+            passFrame(processedFrames, item, dropOldest, stop);
+        }
+    });
+
+    // Prediction stage
+    std::thread predictThread([&]() {
+        PipelineFrame item;
+        vector<uint64_t> packedFrame(packedWords(model.preprocessing.featureSize.area()));
+        float lastResponse = 0;
+        while (takeFrame(processedFrames, item, dropOldest, stop)) {
+            if (item.last) {
+                passFrame(predictedFrames, item, dropOldest, stop);
+                break;
+            }
+            if (item.skipped || item.reused) {
+                item.response = lastResponse;
+                if (item.reused)
+                    Instrumentation::record(STAGE_END_TO_END, item.captureNs, Instrumentation::now());
+                passFrame(predictedFrames, item, dropOldest, stop);
+                continue;
+            }
+            ScopedTimer predictTimer(STAGE_PREDICT);
+            if (packedInference) {
+                packMask(item.processed.ptr<uchar>(), (int)item.processed.total(), &packedFrame[0]);
+                item.response = (float)model.packedScorer.predict(&packedFrame[0]);
+            } else {
+                item.response = predictProcessed(model, item.processed);
+            }
+            predictTimer.stop();
+            lastResponse = item.response;
+            Instrumentation::record(STAGE_END_TO_END, item.captureNs, Instrumentation::now());
+            passFrame(predictedFrames, item, dropOldest, stop);
+        }
+    });
 
     //Starts the clock - after it predicts a gesture it waits 3 seconds to try to predict the next
     bool sleep = false;
-    std::clock_t start = std::clock();
+    int64_t start = Instrumentation::now();
     double duration;
 
-    cout << endl << "The predicted sequence of numbers are:" << endl << endl;
+    // Predictions of the frames with a true class, to check them at the end
+    vector<int> trueClasses, predictions;
+    int predictedCount = 0;
+
+    if (showWindows)
+        cout << endl << "The predicted sequence of numbers are:" << endl << endl;
     while (1)
     {
-        // Capture the camera frame and show the original
-        cv::Mat frame;
-        cap >> frame;
-        cv::imshow(windowOriginal, frame);
-
-        //Process the image
-        int hsvConfig [6]= {minH, maxH, minS, maxS, minV, maxV};
-        Mat hsv = processImage(frame, hsvConfig);
-
-        //Show the processed image
-        cv::imshow(windowProcessed, hsv);
-
-        // Convert to format for training
-        Mat floatImg;
-        hsv.convertTo(floatImg, CV_32F);
-
-        // Predicting the current frame
-        //cout << "Predicting"<<endl;
-        Mat reshaped = floatImg.reshape(1,1);
-        //cout << "rows:" << reshaped.rows << " cols: "<< reshaped.cols << endl;
-        float response = svm->predict(reshaped);
-
-        duration = ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
-        if(duration >= 3){
-            sleep = false;
+        // Show the last predicted frame, if there is a new one
+        PipelineFrame result;
+        bool hasResult;
+        if (showWindows) {
+            int dropped = 0;
+            hasResult = dropOldest ? predictedFrames.popLatest(result, dropped) : predictedFrames.pop(result);
+            if (dropped > 0)
+                Instrumentation::add(COUNTER_DROPPED_FRAMES, dropped);
+        } else {
+            hasResult = takeFrame(predictedFrames, result, dropOldest, stop);
         }
 
-        //cout << "sleep: " << sleep << " | elapsed: " << duration << endl;
-        if(!sleep){
-            // Show the correspondent image depending on the prediction
-            bool didPredict = true;
-            if(response == 1){
-                imgPred = imread("support_images//1.png");
-                imshow(windowPred, imgPred);
-                cout << response ;
-            } else if(response == 2){
-                imgPred = imread("support_images//2.png");
-                imshow(windowPred, imgPred);
-                cout << response ;
-            } else if(response == 3){
-                imgPred = imread("support_images//3.png");
-                imshow(windowPred, imgPred);
-                cout << response ;
-            } else if(response == 4){
-                imgPred = imread("support_images//4.png");
-                imshow(windowPred, imgPred);
-                cout << response ;
-            } else if(response == 5){
-                imgPred = imread("support_images//5.png");
-                imshow(windowPred, imgPred);
-                cout << response ;
-            } else {
-                imgPred = imread("support_images//0.png");
-                imshow(windowPred, imgPred);
-                didPredict = false;
+        if (hasResult && result.last)
+            break;
+        if (hasResult && !result.skipped) {
+            predictedCount++;
+            if (result.label >= 0) {
+                trueClasses.push_back(result.label);
+                predictions.push_back((int)result.response);
             }
+        }
 
-            // Restarts the inactive clock if it did predict
-            if (didPredict){
-                //Restarts
-                start = std::clock();
-                sleep = true;
+        if (hasResult && showWindows) {
+            ScopedTimer displayTimer(STAGE_DISPLAY);
+            cv::imshow(windowOriginal, result.frame);
+            cv::imshow(windowProcessed, displayImage(result.processed));
+            float response = result.response;
 
+            duration = ( Instrumentation::now() - start ) / 1e9;
+            if(duration >= COOLDOWN_NS / 1e9){
+                sleep = false;
             }
 
+            //cout << "sleep: " << sleep << " | elapsed: " << duration << endl;
+            if(!sleep && !result.skipped){
+                // Show the correspondent image depending on the prediction
+                bool didPredict = response >= 1 && response <= 5;
+                imgPred = imgNumbers[didPredict ? (int)response : 0];
+                imshow(windowPred, imgPred);
+                if (didPredict)
+                    cout << response ;
+
+                // Restarts the inactive clock if it did predict
+                if (didPredict){
+                    //Restarts
+                    start = Instrumentation::now();
+                    sleep = true;
+                    cooldownEndNs = start + COOLDOWN_NS;
+                    Instrumentation::add(COUNTER_PREDICTIONS);
+                }
+
+            }
         }
 
         // If a key is pressed stops the loop and closes the windows
-        if (cv::waitKey(30) >= 0) {
-            cout << endl << endl << "Closing the prediction." << endl ;
-            // Close the windows
-            cvDestroyWindow(windowPred);
-            cvDestroyWindow(windowOriginal);
-            cvDestroyWindow(windowProcessed);
+        if (showWindows && cv::waitKey(1) >= 0)
             break;
+    }
+    double seconds = (Instrumentation::now() - runStart) / 1e9;
+
+    // Stop the stages of the pipeline
+    stop = true;
+    captureThread.join();
+    processThread.join();
+    predictThread.join();
+
+    cout << endl << endl << "Closing the prediction." << endl ;
+    if (showWindows) {
+        // Close the windows
+        cvDestroyWindow(windowPred);
+        cvDestroyWindow(windowOriginal);
+        cvDestroyWindow(windowProcessed);
+    }
+
+    // Print the throughput and check the predictions with the true classes
+    cout << "Predicted " << predictedCount << " frames in " << seconds << " seconds (" << (seconds > 0 ? predictedCount / seconds : 0) << " frames/second)" << endl;
+    if (!predictions.empty())
+        summarizePredictions(model.classLabels, trueClasses, predictions, seconds, source->name()).print(cout, source->name());
+
+    writeProfile();
+}
+
+
+/**
+    Structure with a stream of the multi-stream mode: its source, its own buffers and the state of its predictions.
+    Only one worker at a time works on a stream (the one that sets busy), so its frames are predicted in order.
+*/
+struct StreamState {
+    Ptr<FrameSource> source;
+    int hsvConfig[6];
+    PreprocessWorkspace workspace;  // Buffers of the processing, reused for every frame
+    ChangeGate gate;                // Gate of the frames where the scene didn't change
+    Mat frame;
+    vector<uint64_t> packedFrame;
+    std::atomic<bool> busy;
+    std::atomic<bool> finished;
+
+    // Cooldown: after it predicts a gesture it waits 3 seconds to try to predict the next
+    bool sleep;
+    int64_t lastPredictionNs;
+    string sequence;                // Predicted sequence of numbers
+    int lastResponse;               // Prediction of the last evaluated frame, reused while the scene doesn't change
+
+    int frames;
+    int labelled;                   // Frames with a true class
+    int correct;                    // Frames with a true class correctly predicted
+    int64_t nextFrameNs;            // Time of the next frame when the source is paced
+    int64_t startNs;
+    int64_t endNs;
+
+    StreamState() : busy(false), finished(false), sleep(false), lastPredictionNs(0), lastResponse(-1), frames(0), labelled(0), correct(0), nextFrameNs(0), startNs(0), endNs(0) {}
+};
+
+/**
+    Function that reads, processes and predicts the next frame of a stream.
+    The frames of the cooldown of a prediction are not classified, and the frames where the scene didn't change reuse the last prediction.
+    Params:
+        stream - The stream, owned by the calling worker
+        model - The model, shared by all the streams
+        packedInference - If the frames are scored bit-packed
+        maxSpeed - If the replayed sources are read as fast as possible instead of at their frame rate
+    Returns: true if a frame was read.
+*/
+bool predictStreamFrame(StreamState& stream, const HandModel& model, bool packedInference, bool maxSpeed){
+    bool isReplay = stream.source->fps() > 0;
+    int64_t now = Instrumentation::now();
+    if (isReplay && !maxSpeed && now < stream.nextFrameNs)
+        return false;
+
+    ScopedTimer captureTimer(STAGE_CAPTURE);
+    int label = -1;
+    bool hasFrame = stream.source->read(stream.frame, label);
+    captureTimer.stop();
+    if (!hasFrame || stream.frame.empty()) {
+        if (isReplay) {
+            stream.endNs = Instrumentation::now();
+            stream.finished = true;
+        } else {
+            Instrumentation::add(COUNTER_DROPPED_FRAMES);
+        }
+        return false;
+    }
+    int64_t captureNs = Instrumentation::now();
+    if (isReplay)
+        stream.nextFrameNs = std::max(stream.nextFrameNs, captureNs - (int64_t)1e9) + (int64_t)(1e9 / stream.source->fps());
+
+    Instrumentation::add(COUNTER_FRAMES);
+    stream.frames++;
+    if (stream.sleep && captureNs - stream.lastPredictionNs < COOLDOWN_NS) {
+        stream.gate.reset();
+        Instrumentation::add(COUNTER_COOLDOWN_FRAMES);
+        return true;
+    }
+
+    int response = stream.lastResponse;
+    if (stream.lastResponse >= 0 && !stream.gate.changed(stream.frame, stream.hsvConfig)) {
+        Instrumentation::add(COUNTER_UNCHANGED_FRAMES);
+    } else {
+        ScopedTimer processTimer(STAGE_PROCESS_FRAME);
+        const Mat& processed = processImage(stream.frame, stream.hsvConfig, model.preprocessing, stream.workspace);
+        processTimer.stop();
+
+        ScopedTimer predictTimer(STAGE_PREDICT);
+        if (packedInference) {
+            packMask(processed.ptr<uchar>(), (int)processed.total(), &stream.packedFrame[0]);
+            response = model.packedScorer.predict(&stream.packedFrame[0]);
+        } else {
+            response = (int)predictProcessed(model, processed);
+        }
+        predictTimer.stop();
+        stream.lastResponse = response;
+        Instrumentation::add(COUNTER_EVALUATED_FRAMES);
+    }
+    int64_t predictedNs = Instrumentation::now();
+    Instrumentation::record(STAGE_END_TO_END, captureNs, predictedNs);
+
+    if (label >= 0) {
+        stream.labelled++;
+        if (response == label)
+            stream.correct++;
+    }
+
+    // Add the gesture to the sequence, unless it is in the cooldown of the previous one
+    if (stream.sleep && predictedNs - stream.lastPredictionNs >= COOLDOWN_NS)
+        stream.sleep = false;
+    if (!stream.sleep && response >= 1 && response <= 5) {
+        stream.sequence += (char)('0' + response);
+        stream.lastPredictionNs = predictedNs;
+        stream.sleep = true;
+        Instrumentation::add(COUNTER_PREDICTIONS);
+    }
+    return true;
+}
+
+/**
+    Function that predicts several sources of frames (cameras, video files or folders of images) at the same time.
+    A pool of workers shares the model, loaded once and never modified, and each worker takes in turn the streams that are not being predicted.
+    Each stream keeps its own buffers and the cooldown of its predictions. At the end it prints the frames per second of each stream and of all of them.
+    Params:
+        sources - The sources of the frames
+        numWorkers - Number of worker threads, one per core if it is 0
+        maxSpeed - If the replayed sources are read as fast as possible instead of at their frame rate
+*/
+void predictStreams(const vector<Ptr<FrameSource> >& sources, int numWorkers, bool maxSpeed){
+
+    // Load SVM Model, shared by all the streams
+    cout << "Loading SVM Model" << endl;
+    HandModel loadedModel;
+    if (!loadPredictionModel(loadedModel))
+        return;
+    const HandModel& model = loadedModel;
+
+    // Variable to score the bit-packed frames with the 8 bits quantized weights (faster on low-end CPUs, only for binary processed images)
+    bool packedInference = false;
+    packedInference = packedInference && !model.packedScorer.empty();
+
+    // Create the streams
+    vector<std::unique_ptr<StreamState> > streams;
+    bool hasLiveSource = false;
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (!sources[i]->isOpened()) {
+            cout << "Error opening the source of frames: " << sources[i]->name() << endl;
+            continue;
         }
+        std::unique_ptr<StreamState> stream(new StreamState());
+        stream->source = sources[i];
+        stream->source->setWorkWidth(model.preprocessing.workWidth);
+        stream->workspace.trackHand = true;
+        loadHsvConfig(stream->hsvConfig, sources[i]->usesDatasetThreshold());
+        stream->packedFrame.resize(packedWords(model.preprocessing.featureSize.area()));
+        hasLiveSource = hasLiveSource || sources[i]->fps() <= 0;
+        streams.push_back(std::move(stream));
+    }
+    if (streams.empty())
+        return;
+
+    // Launch the workers, each one goes over the streams taking the ones that are free
+    std::atomic<bool> stop(false);
+    WorkStealingPool pool(numWorkers);
+    cout << "Predicting " << streams.size() << " streams with " << pool.size() << " workers" << (maxSpeed ? " as fast as possible" : "") << endl;
+    int64_t startNs = Instrumentation::now();
+    for (size_t i = 0; i < streams.size(); i++)
+        streams[i]->startNs = startNs;
+    for (int w = 0; w < pool.size(); w++) {
+        pool.submit([&, w]() {
+            size_t next = w % streams.size();
+            while (!stop) {
+                bool active = false, predicted = false;
+                for (size_t k = 0; k < streams.size(); k++, next = (next + 1) % streams.size()) {
+                    StreamState& stream = *streams[next];
+                    if (stream.finished)
+                        continue;
+                    active = true;
+                    bool expected = false;
+                    if (!stream.busy.compare_exchange_strong(expected, true))
+                        continue;
+                    predicted = predictStreamFrame(stream, model, packedInference, maxSpeed) || predicted;
+                    stream.busy = false;
+                }
+                if (!active)
+                    break;
+                if (!predicted)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+
+    // The cameras never end, they are stopped by the user
+    if (hasLiveSource) {
+        cout << "Press Enter to stop..." << endl;
+        string input;
+        getline(cin, input);
+        stop = true;
+    }
+    pool.wait();
+    int64_t endNs = Instrumentation::now();
+
+    // Print the statistics of each stream and of all of them
+    int totalFrames = 0;
+    for (size_t i = 0; i < streams.size(); i++) {
+        StreamState& stream = *streams[i];
+        double seconds = ((stream.finished ? stream.endNs : endNs) - stream.startNs) / 1e9;
+        totalFrames += stream.frames;
+        cout << " Stream " << i << " (" << stream.source->name() << "): " << stream.frames << " frames, " << (seconds > 0 ? stream.frames / seconds : 0) << " frames/second";
+        if (stream.labelled > 0)
+            cout << ", accuracy " << stream.correct * 100.0 / stream.labelled;
+        cout << endl << "  Predicted sequence: " << stream.sequence << endl;
     }
+    double seconds = (endNs - startNs) / 1e9;
+    cout << " All streams: " << totalFrames << " frames in " << seconds << " seconds (" << (seconds > 0 ? totalFrames / seconds : 0) << " frames/second)" << endl;
+
+    writeProfile();
 }
 
+/**
+    Function that runs the prediction service: it loads the model once and predicts the frames sent by other processes over a Unix domain socket.
+    Params:
+        socketPath - The path of the socket
+        maxBatch - Maximum number of frames predicted together
+        maxWaitMs - Maximum time a frame waits for more frames to fill its batch
+*/
+void servePredictions(const string& socketPath, int maxBatch, double maxWaitMs){
+    // Load SVM Model
+    HandModel model;
+    if (!loadPredictionModel(model))
+        return;
+
+    // Read the HSV configuration, or use the threshold of the training images
+    int hsvConfig [6];
+    loadHsvConfig(hsvConfig, false);
+
+    PredictionServer server(model, hsvConfig, maxBatch, maxWaitMs);
+    cout << "Serving predictions on " << socketPath << " (batches of up to " << maxBatch << " frames, waiting up to " << maxWaitMs << " ms)" << endl;
+    if (!server.run(socketPath)) {
+        cout << "Error creating the socket: " << socketPath << endl;
+        return;
+    }
+    cout << "Service stopped: " << server.stats() << endl;
+    writeProfile();
+}
 
 /**
     Main function of the program.
@@ -568,6 +1604,86 @@ int main( int argc, char** argv )
     // Print the title of the program
     cout << "Hand Gesture Classifier" << endl;
 
+    // Run the prediction service without the menu: --serve [socket path] [max batch] [max wait ms]
+    // It runs until it is stopped, so it doesn't keep the trace events
+    if (argc >= 2 && string(argv[1]) == "--serve") {
+        servePredictions(argc >= 3 ? argv[2] : DEFAULT_SOCKET_PATH, argc >= 4 ? atoi(argv[3]) : 16, argc >= 5 ? atof(argv[4]) : 2);
+        return 0;
+    }
+
+    // Keep the events of the instrumentation to write the trace of the session
+    Instrumentation::setTracing(true);
+
+    // Compare the linear trainer with SVM::train without the menu: --compare-trainers [threads]
+    if (argc >= 2 && string(argv[1]) == "--compare-trainers") {
+        compareLinearTrainers(argc >= 3 ? atoi(argv[2]) : 0);
+        return 0;
+    }
+
+    // Train streaming the images in batches without the menu: --stream-train [--warm] [--batch N] [--epochs N]
+    if (argc >= 2 && string(argv[1]) == "--stream-train") {
+        bool warmStart = false;
+        int batchSize = 64, epochs = 5;
+        for (int i = 2; i < argc; i++) {
+            if (string(argv[i]) == "--warm")
+                warmStart = true;
+            else if (string(argv[i]) == "--batch" && i + 1 < argc)
+                batchSize = max(1, atoi(argv[++i]));
+            else if (string(argv[i]) == "--epochs" && i + 1 < argc)
+                epochs = max(1, atoi(argv[++i]));
+        }
+        trainStreaming(warmStart, batchSize, epochs);
+        return 0;
+    }
+
+    // Convert HandNumbersClassifier_01.dat into the binary bundle of the prediction modes: --convert-model
+    if (argc >= 2 && string(argv[1]) == "--convert-model") {
+        convertModel();
+        return 0;
+    }
+
+    // Compare the accuracy and the cost of the feature extractors without the menu: --compare-features
+    if (argc >= 2 && string(argv[1]) == "--compare-features") {
+        compareFeatureExtractors();
+        return 0;
+    }
+
+    // Search the parameters of the SVM without the menu: --search [folds] [random count]
+    if (argc >= 2 && string(argv[1]) == "--search") {
+        searchSVM(argc >= 3 ? max(2, atoi(argv[2])) : 5, argc >= 4 ? atoi(argv[3]) : 0);
+        return 0;
+    }
+
+    // Predict several sources at the same time without the menu: --streams [--max-speed] [--workers N] <source> <source>...
+    if (argc >= 2 && string(argv[1]) == "--streams") {
+        bool maxSpeed = false;
+        int numWorkers = 0;
+        vector<Ptr<FrameSource> > sources;
+        for (int i = 2; i < argc; i++) {
+            if (string(argv[i]) == "--max-speed")
+                maxSpeed = true;
+            else if (string(argv[i]) == "--workers" && i + 1 < argc)
+                numWorkers = atoi(argv[++i]);
+            else
+                sources.push_back(openFrameSource(argv[i]));
+        }
+        predictStreams(sources, numWorkers, maxSpeed);
+        return 0;
+    }
+
+    // Configure the HSV thresholds over a source without the menu: --configure [source]
+    if (argc >= 2 && string(argv[1]) == "--configure") {
+        configureCamera(openFrameSource(argc >= 3 ? argv[2] : "camera"));
+        return 0;
+    }
+
+    // Replay a video file or a folder of images without the menu: --replay <path> [--max-speed]
+    if (argc >= 3 && string(argv[1]) == "--replay") {
+        bool maxSpeed = argc >= 4 && string(argv[3]) == "--max-speed";
+        readCameraAndPredict(openFrameSource(argv[2]), maxSpeed);
+        return 0;
+    }
+
 
     // Variable to control if the program should stop
     bool endProgram = false;
@@ -579,8 +1695,11 @@ int main( int argc, char** argv )
         cout << endl;
         cout << "The following options are available. Press the correspondent key to continue:" << endl;
         cout << "P - Starts the Camera and reads the hand gestures shown to it." << endl;
+        cout << "R - Replays a video file or a folder of images and predicts its frames." << endl;
+        cout << "M - Predicts several cameras, video files or folders of images at the same time." << endl;
         cout << "C - Configure the threshold of the camera for a better prediction." << endl;
         cout << "T - Train the SVM model based on the images present in the images folder." << endl;
+        cout << "S - Search the best parameters of the SVM model with cross-validation and store the best model." << endl;
         cout << "Q - Quits this program." << endl;
         cout << endl << "Select an option to continue..." << endl;
 
@@ -596,6 +1715,28 @@ int main( int argc, char** argv )
             //Read from Camera and Predict
             readCameraAndPredict();
 
+        } else if(keyPressed == 82 || keyPressed == 114) {
+            cout << "Replay and Predict" << endl;
+            // Ask for the source and how to replay it
+            string path = "", answer = "";
+            cout << "Path of the video file or the folder of images:" << endl;
+            getline(cin, path);
+            cout << "Replay it as fast as possible, without windows? (y/n)" << endl;
+            getline(cin, answer);
+            readCameraAndPredict(openFrameSource(path), !answer.empty() && (answer[0] == 'y' || answer[0] == 'Y'));
+
+        } else if(keyPressed == 77 || keyPressed == 109) {
+            cout << "Predict Several Streams" << endl;
+            // Ask for the sources, one per line
+            vector<Ptr<FrameSource> > sources;
+            string path = "", answer = "";
+            cout << "Sources (\"camera\", a camera number, a video file or a folder of images), one per line. Empty line to finish:" << endl;
+            while (getline(cin, path) && !path.empty())
+                sources.push_back(openFrameSource(path));
+            cout << "Replay them as fast as possible? (y/n)" << endl;
+            getline(cin, answer);
+            predictStreams(sources, 0, !answer.empty() && (answer[0] == 'y' || answer[0] == 'Y'));
+
         } else if(keyPressed == 67 || keyPressed == 99) {
             cout << "Configure Webcam" << endl;
             // Configure Webcam
@@ -605,6 +1746,10 @@ int main( int argc, char** argv )
             cout << "Train Model" << endl;
             //Train Model
             trainSVM();
+        } else if(keyPressed == 83 || keyPressed == 115) {
+            cout << "Search SVM Parameters" << endl;
+            // Search the parameters with 5 folds over the whole grid
+            searchSVM(5, 0);
         } else if(keyPressed == 81 || keyPressed == 113) {
             cout << "Exit" << endl;
             //Exit the program.